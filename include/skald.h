@@ -1,15 +1,26 @@
 #pragma once
 
 #include <array>
+#include <atomic>
 #include <cassert>
+#include <condition_variable>
 #include <cstddef>
+#include <cstdint>
+#include <deque>
 #include <filesystem>
 #include <functional>
+#include <list>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
 #include <unistd.h>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <variant>
 #include <vector>
 
@@ -64,6 +75,24 @@ inline static std::string val_type_to_str(const ValueType &type) {
   return "!!INVALID!!";
 }
 
+/** The ValueType a C++ type carries in and out of native method bindings
+ *  (see Engine::bind_method); void is ACTION. */
+template <typename T> constexpr ValueType value_type_of() {
+  if constexpr (std::is_same_v<T, std::string>) {
+    return STRING;
+  } else if constexpr (std::is_same_v<T, bool>) {
+    return BOOL;
+  } else if constexpr (std::is_same_v<T, int>) {
+    return INT;
+  } else if constexpr (std::is_same_v<T, float>) {
+    return FLOAT;
+  } else {
+    static_assert(std::is_void_v<T>,
+                  "Skald methods take and return string, bool, int or float");
+    return ACTION;
+  }
+}
+
 enum class VarScope { GLOBAL, MODULE, LOCAL };
 inline std::string scope_to_str(VarScope s) {
   switch (s) {
@@ -81,6 +110,12 @@ struct Variable {
   std::string name;
   ValueType type;
 
+  /** Resolved by the parser (see ParseState::resolve_var). Globals index the
+   *  codex's global_vars, module vars the module's module_vars, and any name
+   *  declared in neither gets a slot in the module's local_vars. */
+  VarScope scope = VarScope::LOCAL;
+  uint32_t slot = 0;
+
   std::string dbg_desc() const {
     std::string ret = name + " (" + val_type_to_str(type) + +")";
     return ret;
@@ -202,10 +237,23 @@ struct ArgDef {
   std::string dbg_desc() const { return name + ": " + val_type_to_str(type); }
 };
 
+/** When an answer already in the query cache may stand in for asking the
+ *  client again. */
+enum class CachePolicy {
+  NEVER,     // Every call is asked, even a repeat on the same step
+  PER_BEAT,  // Reused while the cursor stays on one step (e.g. a choice group)
+  PER_BLOCK, // Reused until the cursor enters a block again
+  PURE,      // Reused for as long as it's cached
+};
+
 struct MethodDef : LineEntity {
   std::string name;
   ValueType return_type;
   std::vector<ArgDef> args;
+
+  /** From an annotation like `@pure` in the codex; the engine's default
+   *  policy applies when unset. */
+  std::optional<CachePolicy> cache_policy;
   std::string dbg_desc() const {
     auto ret = name + "(";
     auto i = 0;
@@ -218,9 +266,33 @@ struct MethodDef : LineEntity {
   }
 };
 
+/** Identifies a query for answer caching: the method plus its argument
+ *  values. Calls whose args are all literals get theirs once when parsed (see
+ *  key_for_call), hash included, so cache lookups don't build strings; any
+ *  others are keyed by what their args resolve to at query time (see
+ *  Engine::query_key). */
+struct QueryKey {
+  std::string text;
+  size_t hash = 0;
+
+  bool operator==(const QueryKey &other) const {
+    return hash == other.hash && text == other.text;
+  }
+
+  /** Hasher for unordered containers; just hands back the stored hash. */
+  struct Hash {
+    size_t operator()(const QueryKey &key) const { return key.hash; }
+  };
+};
+
 struct MethodCall : LineEntity {
   std::string method;
   std::vector<RValue> args;
+  QueryKey key;
+
+  /** Index into Codex::method_defs, if the codex has the method */
+  int method_index = -1;
+
   std::string dbg_desc() const; // Declare only for circular dep reasons
 };
 
@@ -245,13 +317,16 @@ inline std::string rval_to_string(const VariantType &val) {
       val);
 }
 
-/** The key used to encode a query for answer caching */
-inline std::string key_for_call(MethodCall &call) {
-  std::string ret = call.method;
+/** Builds the key used to encode a query for answer caching, taking args as
+ *  written. The parser stores this on each MethodCall; it's only the real key
+ *  if every arg is a literal (see Engine::query_key). */
+inline QueryKey key_for_call(const MethodCall &call) {
+  QueryKey key{.text = call.method};
   for (auto &arg : call.args) {
-    ret += "|" + rval_to_string(arg);
+    key.text += "|" + rval_to_string(arg);
   }
-  return ret;
+  key.hash = std::hash<std::string>{}(key.text);
+  return key;
 }
 
 // Now define MethodCall::dbg_desc after rval_to_string is available
@@ -377,7 +452,7 @@ struct Testbed : LineEntity {
 
 struct Mutation : LineEntity {
   enum Type { EQUATE, SWITCH, ADD, SUBTRACT };
-  std::string lvalue;
+  Variable lvalue;
   Type type;
   std::optional<RValue> rvalue;
   static std::string label_for_type(Type t) {
@@ -397,7 +472,7 @@ struct Mutation : LineEntity {
     }
   }
   std::string dbg_desc() const {
-    std::string ret = "<" + lvalue + " " + label_for_type(type);
+    std::string ret = "<" + lvalue.name + " " + label_for_type(type);
     if (rvalue) {
       ret += " " + rval_to_string(*rvalue);
     }
@@ -427,6 +502,9 @@ struct Exit : LineEntity {
 
 struct Move : LineEntity {
   std::string target_tag;
+
+  /** Index into Module::blocks; filled in by link_module after parsing. */
+  int target_block = -1;
 };
 
 /* DEBUG OUTPUT STUFF TO DELETE LATER */
@@ -612,10 +690,89 @@ inline bool mbm_is_chain(const MainBlockMember &m) {
 struct Block : LineEntity {
   std::string tag;
   std::vector<MainBlockMember> members{};
+
+  /** False for the blocks of a lazily loaded module, which only hold what
+   *  their tag line says; the body is parsed into the module's LazyBlocks
+   *  when the block is first entered. */
+  bool parsed = true;
+};
+
+// SECTION: Compiled program
+
+/** One step of a compiled Module. Each Member lowers to a single instruction
+ *  keyed by its body type; choice groups and conditional chains lower to
+ *  jumps between them, so the engine never has to walk the block tree. */
+struct Instruction {
+  enum Op : uint8_t {
+    BEAT,
+    MOVE,
+    CALL,
+    MUTATE,
+    GO,
+    EXIT,
+    CHOICES, // Presents an OptionGroup; act(n) jumps to choice n's members
+    BRANCH,  // Falls through if cond resolves true, else jumps to target
+    JUMP,
+    ENTER, // Ends a lazily loaded block's segment: carry on in block target
+           // (see compile_block)
+    END    // Past the last block
+  };
+  Op op;
+
+  /** First instruction of a block; arriving here counts as entering it. */
+  bool block_start = false;
+
+  /** JUMP / BRANCH / MOVE destination, or for CHOICES the offset of its first
+   *  entry in Program::choice_targets. A MOVE whose tag didn't link targets
+   *  NO_TARGET. For ENTER, and a MOVE in a lazily loaded block, the block to
+   *  go to. */
+  uint32_t target = 0;
+  static constexpr uint32_t NO_TARGET = UINT32_MAX;
+
+  size_t line_number = 0;
+
+  /** The member's attached condition, if it has one; the member is skipped
+   *  when it resolves false. */
+  const AttachedCondition *ac = nullptr;
+
+  /** This instruction's query manifest: every method call its conditions
+   *  contain, as a range of Program::queries. */
+  uint32_t query_begin = 0;
+  uint32_t query_count = 0;
+
+  /** The source entity this instruction runs; which one is set follows op. */
+  union {
+    const Beat *beat = nullptr;
+    const Move *move;
+    const MethodCall *call;
+    const Mutation *mutation;
+    const GoModule *go;
+    const Exit *exit;
+    const ChoiceGroup *group;
+    const Conditional *cond;
+  };
+
+  std::string dbg_desc() const;
+};
+
+/** The flat, linear form of a Module that the engine actually runs. Holds
+ *  pointers into the Module it was compiled from, so it lives inside it. */
+struct Program {
+  std::vector<Instruction> code;
+
+  /** pc of each block's first instruction, indexed like Module::blocks */
+  std::vector<uint32_t> block_entry;
+
+  /** pc of the first member of each choice, grouped per CHOICES instruction */
+  std::vector<uint32_t> choice_targets;
+
+  /** Every instruction's query manifest, back to back */
+  std::vector<const MethodCall *> queries;
 };
 
 /** The Codex defines globals, methods, and project root. Only one codex is
- * active on the engine at a time. Resetting codex resets state. */
+ * active on the engine at a time. Resetting codex resets state. A loaded codex
+ * is never modified, so engines can share one (see load_codex). */
 struct Codex {
   std::string path;
   std::string filename;
@@ -623,32 +780,85 @@ struct Codex {
   /** Global-scoped variables */
   std::vector<DeclaredVar> global_vars;
 
+  /** Global name -> slot (index into global_vars) */
+  std::unordered_map<std::string, uint32_t> global_slots;
+
   /** Method definitions */
   std::vector<MethodDef> method_defs;
 
+  int get_method_index(const std::string &name) const {
+    for (size_t i = 0; i < method_defs.size(); i++) {
+      if (method_defs[i].name == name)
+        return (int)i;
+    }
+    return -1;
+  }
+
+  int get_global_slot(const std::string &name) const {
+    auto it = global_slots.find(name);
+    return it != global_slots.end() ? (int)it->second : -1;
+  }
+
   /** Full path to the codex file itself. */
-  std::string codex_path() {
+  std::string codex_path() const {
     return (std::filesystem::path(path) / filename).string();
   }
 
   /** Resolves a module path relative to the codex's directory: with a codex
    *  at ~/project/example.codex, "a/b/c.ska" -> "~/project/a/b/c.ska". */
-  std::string resolve_path(const std::string &rel_path) {
+  std::string resolve_path(const std::string &rel_path) const {
     return (std::filesystem::path(path) / rel_path).string();
   }
 };
 
+/** What a lazily loaded module keeps to parse its blocks later, and the
+ *  blocks parsed so far (see Module::lazy) */
+struct LazyBlocks;
+struct ParsedBlock;
+
 /** A Module is a single Skald file. Only one module is loaded at a time, but
  *  global state persists between modules, and module vars get pushed on GO
- *  transitions. */
+ *  transitions. Like the codex, a loaded module is immutable and shareable:
+ *  everything an engine changes while running it lives on the engine. */
 struct Module {
+  Module() = default;
+  Module(Module &&) = default;
+  Module &operator=(Module &&) = default;
+
+  /** Not copyable: program points into blocks, and a copy's would still
+   *  point into the original's. Moving keeps the blocks where they are. */
+  Module(const Module &) = delete;
+  Module &operator=(const Module &) = delete;
+
   std::string filename;
+
+  /** The codex its globals and methods were resolved against (may be null).
+   *  Slots and method indices only hold for that codex. */
+  std::shared_ptr<const Codex> codex;
   std::vector<DeclaredVar> module_vars;
+
+  /** Names used in the module but declared neither here nor in the codex;
+   *  LOCAL Variables index into this. */
+  std::vector<std::string> local_vars;
+
   std::vector<Testbed> testbeds;
   std::vector<Block> blocks;
   std::unordered_map<std::string, size_t> block_lookup;
 
-  int get_block_index(const std::string &tag) {
+  /** Stable hash of the source it was parsed from, so snapshots can tell
+   *  whether they were taken on this exact version of the file. */
+  uint64_t source_hash = 0;
+
+  /** Compiled after parsing (see compile_module); this is what runs. Empty
+   *  for a lazily loaded module, which runs block by block instead. */
+  Program program;
+
+  /** Set if the module was loaded lazily (see load_module). Parsing a block
+   *  doesn't change the module: the parsed block goes into this table, once,
+   *  for every engine running the module. */
+  std::shared_ptr<LazyBlocks> lazy;
+
+  int get_block_index(const std::string &tag) const {
     auto it = block_lookup.find(tag);
     return it != block_lookup.end() ? it->second : -1;
   }
@@ -681,7 +891,15 @@ struct OptionGroup {
 struct MethodCallGet {
   MethodCall call;
   size_t line_number = 0;
-  std::string get_key() { return key_for_call(call); }
+
+  /** Identifies this query when answering out of order (see
+   *  Engine::pending_queries); unique per engine. */
+  uint32_t ticket = 0;
+
+  /** The call's cache key, with args resolved when it was queued */
+  QueryKey key;
+
+  const QueryKey &get_key() const { return key; }
 };
 
 struct MethodCallPost {
@@ -707,6 +925,11 @@ const uint ERROR_LOADING_MODULE = 12;
 const uint ERROR_NO_GLOBAL = 13;
 const uint ERROR_OUT_OF_BOUNDS = 14;
 const uint ERROR_START_EMPTY_BLOCK = 15;
+const uint ERROR_UNKNOWN_TICKET = 16;
+const uint ERROR_BAD_BINDING = 17;
+const uint ERROR_BAD_SNAPSHOT = 18;
+const uint ERROR_NOTHING_TO_REWIND = 19;
+const uint ERROR_PARSING_BLOCK = 20;
 struct Error {
   uint code = 0;
   std::string message;
@@ -729,6 +952,12 @@ struct QueryAnswer {
   std::optional<SimpleRValue> val;
 };
 
+/** An answer to one pending query, by ticket, for Engine::answer_many. */
+struct TicketAnswer {
+  uint32_t ticket;
+  QueryAnswer answer;
+};
+
 struct Notification {
   std::string var_name;
   Mutation::Type mut_type;
@@ -787,6 +1016,26 @@ inline ResponseType get_response_type(Response &response) {
       response);
 }
 
+/** What picking an option would lead to, from Engine::preview. */
+struct ChoicePreview {
+  /** Beats the choice runs into, in order */
+  std::vector<Content> content;
+
+  /** Variables it changes along the way */
+  std::vector<Notification> changes;
+
+  /** Method calls it posts along the way (none are actually run) */
+  std::vector<MethodCallPost> posts;
+
+  /** Where it stopped: the next OptionGroup, or a GoModule, Exit, End or
+   *  Error. A MethodCallGet if it needed a query with no cached answer (see
+   *  unresolved). nullopt if it ran out of steps first. */
+  std::optional<Response> stop;
+
+  /** The queries it couldn't answer from the query cache */
+  std::vector<MethodCallGet> unresolved;
+};
+
 /** Will be sent back by the client following a response, to indicate the
  * next action */
 struct Action {
@@ -798,64 +1047,54 @@ struct Action {
  */
 struct Cursor {
 
-  /** If this is not empty, it marks the block that the engine should jump to on
-   * the next advance_cursor */
-  std::string queued_transition;
-
-  /** Is the next member pre-processed, queries queued etc */
-  bool is_preprocessed = false;
-
-  /** Which block are we currently in */
-  int current_block_index = 0;
-
-  /** Which part are we currently working through */
-  int current_member_index = 0;
-
-  /** If we are in a conditional thread, which block? */
-  int thread_block = 0;
-
-  /** We've processed the conditionals sufficiently to enter a block */
-  bool entered_thread_block = false;
-
-  /** And which member in that block? */
-  int thread_member = 0;
-
-  /** Which choice do we need to process? */
-  int choice_selection = -1;
-
-  /** If >= 0, we are stepping through the operations of a choice. */
-  int choice_thread_index = 0;
+  /** The instruction we are currently on in the module's Program */
+  uint32_t pc = 0;
 
   /** If this is present, do an exit */
-  Exit *queued_exit = nullptr;
+  const Exit *queued_exit = nullptr;
 
   /** If this is present, do a transition */
-  GoModule *queued_go = nullptr;
+  const GoModule *queued_go = nullptr;
 
   /** These track method calls etc. that require queries to the external client.
    *  These have to be resolved by the client via the answer() method before the
-   *  engine will proceed. */
-  std::vector<MethodCallGet> resolution_stack;
+   *  engine will proceed. Only holds what's needed next: conditions are
+   *  short-circuited, so a call is queued once evaluation actually reaches
+   *  it. */
+  struct PendingQuery {
+    const MethodCall *call;
+    uint32_t ticket;
+
+    /** Resolved when queued; the answer is cached under it */
+    QueryKey key;
+  };
+  std::vector<PendingQuery> resolution_stack;
+
+  /** Calls answered since the cursor arrived on the current instruction */
+  std::vector<const MethodCall *> answered;
+
+  /** Native getters already run on the current instruction, so conditions,
+   *  query keys and options that need one again reuse its value */
+  std::vector<std::pair<const MethodCall *, std::optional<SimpleRValue>>>
+      native_results;
 
-  /** Adds more MethodCallGets to the resolution stack. */
-  void add_to_res_stack(std::vector<MethodCallGet> res) {
-    resolution_stack.insert(resolution_stack.end(), res.begin(), res.end());
+  bool was_answered(const MethodCall *call) const {
+    for (auto *a : answered) {
+      if (a == call)
+        return true;
+    }
+    return false;
   }
 
   /** This will reset the cursor to a "new" state. Currently only called on
    *  module entry. */
   void reset() {
     resolution_stack.clear();
-    queued_exit = NULL;
-    queued_go = NULL;
-    queued_transition = "";
-    choice_selection = -1;
-    choice_thread_index = 0;
-    current_block_index = 0;
-    current_member_index = 0;
-    entered_thread_block = false;
-    is_preprocessed = false;
-    // did_last_condition_pass = true;
+    answered.clear();
+    native_results.clear();
+    queued_exit = nullptr;
+    queued_go = nullptr;
+    pc = 0;
   }
 };
 
@@ -890,18 +1129,234 @@ struct ParseResult {
 using SourceReader =
     std::function<std::optional<std::string>(const std::string &resolved_path)>;
 
-/** Default SourceReader: basic fs reader. */
+/** Default SourceReader, used whenever no reader is given: basic fs reader.
+ *  Reads the whole file in, so editing it afterwards can't affect a parse. */
 std::optional<std::string> default_source_reader(const std::string &path);
 
+/** Source bytes lent rather than copied: bytes stays valid for as long as
+ *  owner (a file mapping, a buffer) is held. */
+struct SourceView {
+  std::string_view bytes;
+  std::shared_ptr<const void> owner;
+};
+
+/** Like SourceReader, but lends the bytes, so the parser works directly on
+ *  them instead of on a copy. Either kind of reader can be passed wherever
+ *  one is taken. */
+using SourceViewReader = std::function<std::optional<SourceView>(
+    const std::string &resolved_path)>;
+
+/** Opt-in SourceViewReader that maps the file read-only (or reads it in once
+ *  where mapping isn't available), so it's parsed without a copy. Only for
+ *  files nothing truncates while they're loaded: a lazily loaded module
+ *  keeps its mapping, and reading past a truncated one raises SIGBUS. */
+std::optional<SourceView> mapped_source_reader(const std::string &path);
+
+/** Bundles a project into one .skpak file: files are (path, bytes) pairs,
+ *  where the bytes may be source or compiled (see save_compiled). Paths are
+ *  stored as given, so use the ones the engine will ask for: the codex by
+ *  its name and modules relative to it, e.g. "story.codex", "act1/inn.ska". */
+std::string save_pack(
+    const std::vector<std::pair<std::string, std::string>> &files);
+
+/** A reader serving files out of a .skpak, which is opened and mapped once;
+ *  reads after that don't touch the filesystem or copy. Set the codex up by
+ *  its path inside the pack so module paths resolve to pack paths too.
+ *  Returns nullopt (and why, if asked) if the pack can't be opened or is
+ *  damaged. Safe to call from several threads, as prefetch does. */
+std::optional<SourceViewReader>
+pack_source_reader(const std::string &pack_path, std::string *why = nullptr);
+
+/** A codex or module from load_codex/load_module. value is null only if the
+ *  file couldn't be read or parsed at all; otherwise result may still carry
+ *  warnings or errors, as with Engine::setup/load. */
+template <typename T> struct Loaded {
+  ParseResult result;
+  std::shared_ptr<const T> value;
+};
+
+/** Parses a codex without an engine, so one parse can be set up on any number
+ *  of engines (see Engine::setup(std::shared_ptr<const Codex>)). An empty
+ *  reader means default_source_reader. */
+Loaded<Codex> load_codex(const std::string &path,
+                         const SourceReader &reader = {});
+Loaded<Codex> load_codex(const std::string &path,
+                         const SourceViewReader &reader);
+
+/** Parses, links and compiles a module against codex (which may be null).
+ *  The result can be loaded on every engine set up with the same codex.
+ *
+ *  With lazy_blocks, only the top matter and block tag lines are parsed, so
+ *  loading costs about as much as scanning the file; each block's body is
+ *  parsed the first time the engine enters it, and its parse errors are
+ *  reported then (see Engine::set_lazy_blocks). Compiled modules are always
+ *  loaded whole. */
+Loaded<Module> load_module(const std::string &path,
+                           std::shared_ptr<const Codex> codex,
+                           const SourceReader &reader = {},
+                           bool lazy_blocks = false);
+Loaded<Module> load_module(const std::string &path,
+                           std::shared_ptr<const Codex> codex,
+                           const SourceViewReader &reader,
+                           bool lazy_blocks = false);
+
+/** Encodes a loaded codex or module in Skald's compiled format. A
+ *  SourceReader may hand back these bytes in place of source: load_codex and
+ *  load_module notice and decode them instead of parsing, which is much
+ *  faster. A compiled module records the codex it was compiled against and
+ *  only loads against one with the same globals and method signatures. */
+std::string save_compiled(const Codex &codex);
+
+/** A lazily loaded module has its remaining blocks parsed first; if one
+ *  doesn't parse, returns an empty string, with why set if given. */
+std::string save_compiled(const Module &module, std::string *why = nullptr);
+
+/** Keeps recently loaded modules so that a GO back into one (or any other
+ *  load of it) skips parsing and compiling. Entries are keyed by resolved
+ *  path and checked against the codex they were compiled with and the file:
+ *  read from the filesystem, an unchanged size and modification time is
+ *  enough; through a custom SourceReader, the source is read again and
+ *  compared by hash. Past its byte budget, the least recently used modules
+ *  are dropped. Thread-safe: engines sharing a codex can share a cache
+ *  too. */
+class ModuleCache {
+public:
+  static constexpr size_t DEFAULT_MAX_BYTES = 64 << 20;
+
+  explicit ModuleCache(size_t max_bytes = DEFAULT_MAX_BYTES);
+
+  /** The process-wide cache engines use unless given another */
+  static std::shared_ptr<ModuleCache> shared();
+
+  /** Same contract as load_module, but served from the cache when current.
+   *  A module loaded lazily is only served to lazy loads, and vice versa. */
+  Loaded<Module> load(const std::string &path,
+                      std::shared_ptr<const Codex> codex,
+                      const SourceReader &reader = {},
+                      bool lazy_blocks = false);
+  Loaded<Module> load(const std::string &path,
+                      std::shared_ptr<const Codex> codex,
+                      const SourceViewReader &reader,
+                      bool lazy_blocks = false);
+
+  /** Roughly how much memory the kept modules may take, going by their
+   *  source and compiled sizes. 0 turns caching off. */
+  void set_max_bytes(size_t max_bytes);
+  size_t size() const;
+  size_t bytes() const;
+  void clear();
+
+private:
+  /** What a filesystem read is checked by before trusting the hash */
+  struct FileStamp {
+    std::filesystem::file_time_type mtime;
+    uintmax_t size;
+
+    bool operator==(const FileStamp &other) const {
+      return mtime == other.mtime && size == other.size;
+    }
+  };
+  static std::optional<FileStamp> stamp_of(const std::string &file_path);
+
+  struct Entry {
+    std::string file_path;
+    /** Hash of the bytes read, which for a compiled module isn't its
+     *  source_hash */
+    uint64_t hash;
+    /** Set if it was read from the filesystem */
+    std::optional<FileStamp> stamp;
+    bool lazy_blocks;
+    size_t bytes;
+    ParseResult result;
+    std::shared_ptr<const Module> module;
+  };
+
+  /** Most recently used first */
+  std::list<Entry> entries;
+  std::unordered_map<std::string, std::list<Entry>::iterator> lookup;
+  size_t max_bytes;
+  size_t total_bytes = 0;
+  mutable std::mutex mutex;
+
+  /** The entry for file_path, moved to the front, if it matches the stamp
+   *  or hash given. With a hash, a stale entry is dropped. Expects the lock
+   *  held. */
+  Entry *find(const std::string &file_path,
+              const std::shared_ptr<const Codex> &codex, bool lazy_blocks,
+              const std::optional<FileStamp> &stamp,
+              std::optional<uint64_t> hash);
+
+  void evict();
+};
+
+/** A type-erased native method: takes the call's arguments, already resolved
+ *  and type-checked against the codex, and returns its value (nullopt for
+ *  ACTION methods). */
+using NativeMethod = std::function<std::optional<SimpleRValue>(
+    const std::vector<SimpleRValue> &args)>;
+
+/** Shares a value between forked engines until one of them changes it:
+ *  reads go through get() (or * and ->), and write() first copies the value
+ *  if another engine still holds it. */
+template <typename T> class CopyOnWrite {
+public:
+  CopyOnWrite() : ptr(std::make_shared<T>()) {}
+
+  const T &get() const { return *ptr; }
+  const T &operator*() const { return *ptr; }
+  const T *operator->() const { return ptr.get(); }
+
+  T &write() {
+    if (ptr.use_count() > 1)
+      ptr = std::make_shared<T>(*ptr);
+    return *ptr;
+  }
+
+  /** Swaps in a new value without copying the old one */
+  void replace(T value) { ptr = std::make_shared<T>(std::move(value)); }
+
+private:
+  std::shared_ptr<T> ptr;
+};
+
 class Engine {
 public:
   ParseResult setup(std::string path);
   ParseResult load(std::string path);
   void trace(std::string path);
 
+  /** Sets up with an already loaded codex, possibly shared with other
+   *  engines. Like setup(path), this wipes state and native bindings, and
+   *  unloads a module loaded against another codex. */
+  void setup(std::shared_ptr<const Codex> shared_codex);
+
+  /** Switches to an already loaded module, possibly shared with other
+   *  engines. Fails if it was loaded against a different codex. */
+  ParseResult load(std::shared_ptr<const Module> module);
+
   /** Set source reader for loading raw content of files / abstract entities
    * etc. */
   void set_source_reader(SourceReader reader);
+  void set_source_reader(SourceViewReader reader);
+
+  /** Cache that load() and GO transitions go through. Engines start out on
+   *  ModuleCache::shared(); pass another to keep a set of engines' modules
+   *  apart, or nullptr to parse on every load. */
+  void set_module_cache(std::shared_ptr<ModuleCache> cache);
+
+  /** Off by default. When on, each load queues the modules the new module
+   *  can GO to for parsing on a small pool of background threads shared by
+   *  all engines, so the GO usually finds them already in the module cache.
+   *  Never waits on them: ones not started by the next load are dropped.
+   *  Needs a module cache, and the source reader must be safe to call from
+   *  another thread. */
+  void set_prefetch(bool enabled);
+
+  /** Off by default. When on, modules are loaded with lazy_blocks (see
+   *  load_module): start_at() or a transition into a block parses it first,
+   *  and fails with ERROR_PARSING_BLOCK if it has errors. Worth it for big
+   *  modules of which a session only visits a few blocks. */
+  void set_lazy_blocks(bool enabled);
 
   // Actions
   /** Start the Skald engine at a particular tag. This sets the cursor to the
@@ -916,6 +1371,13 @@ public:
    *  choice if there are choices, or any integer otherwise. */
   Response act(int choice_index = 0);
 
+  /** Runs act(choice_index) and what follows, up to max_steps responses,
+   *  on a fork, so nothing is committed. Queries are answered from the query
+   *  cache whatever their cache policy; the preview stops at the first one
+   *  that isn't cached. Natively bound actions aren't run, but reported as
+   *  posts. Cheap enough to call for every option of a menu. */
+  ChoicePreview preview(int choice_index, int max_steps = 32) const;
+
   /** Get the current response that's awaiting action */
   Response get_current();
 
@@ -923,12 +1385,89 @@ public:
    * returned if a return is expected, or null if not. */
   Response answer(std::optional<QueryAnswer> answer);
 
+  /** Every query the engine is currently waiting on, each with its ticket.
+   *  They can be answered in any order; the engine only moves on once all of
+   *  them are answered. */
+  std::vector<MethodCallGet> pending_queries();
+
+  /** Answers one pending query by ticket. Returns the next pending query
+   *  while any are left, then carries on as answer() does. */
+  Response answer(uint32_t ticket, QueryAnswer answer);
+
+  /** Answers several pending queries at once. Nothing is recorded if any
+   *  ticket isn't pending. */
+  Response answer_many(const std::vector<TicketAnswer> &answers);
+
   /** Sets global state; errors if global doesn't exist or type mismatch. */
   std::optional<Error> set(std::string key, SimpleRValue val);
 
   /** Returns state; errors if not set. */
   std::variant<Error, SimpleRValue> get(std::string key);
 
+  /** Serializes the session into a compact, versioned binary blob: the
+   *  cursor (with its pending queries), global, module and local state, the
+   *  query cache, and which module is loaded. Codex, bindings and settings
+   *  aren't included; they belong to the engine, not the session. */
+  std::vector<uint8_t> snapshot() const;
+
+  /** Resumes a session from snapshot(). The engine must be set up with the
+   *  same codex; the module is loaded by path if it isn't the current one,
+   *  and must be the same version of it. Nothing changes on error. */
+  std::optional<Error> restore(const std::vector<uint8_t> &blob);
+
+  /** Takes a snapshot() and makes it the base that delta() tracks changes
+   *  against. */
+  std::vector<uint8_t> checkpoint();
+
+  /** A small record of what changed since the last checkpoint(), restore(),
+   *  apply_delta() or delta(): vars written since, new query cache answers,
+   *  and the cursor. Deltas apply in order on top of that base. nullopt if
+   *  there is no base, or setting up a codex has wiped state since. */
+  std::optional<std::vector<uint8_t>> delta();
+
+  /** Applies the next delta() on top of a restored base (or the previous
+   *  delta). Nothing changes on error, including a delta out of order. */
+  std::optional<Error> apply_delta(const std::vector<uint8_t> &blob);
+
+  /** A new engine at exactly this position, for exploring choices without
+   *  disturbing this one. It shares the codex, module, module cache and
+   *  bindings, and shares state and the query cache copy-on-write, so a fork
+   *  costs about as much as the cursor until one side starts writing. Forks
+   *  don't track deltas or prefetch until told to. */
+  Engine fork() const;
+
+  /** Off by default. Keeps a journal of each start, act() and answer(): the
+   *  cursor before it, and the old value of every var and cached answer it
+   *  changed, so rewind() can step back without replaying from the start.
+   *  The oldest steps are dropped to keep it under about max_bytes; 0 turns
+   *  it off and clears it. */
+  void set_rewind_limit(size_t max_bytes);
+
+  /** Undoes the last n steps and returns the response that was current
+   *  before them again. Changes made between steps (by set(), say) are
+   *  kept. Errors, changing nothing, if fewer than n steps can be undone.
+   *  Deltas need a new checkpoint() afterwards. */
+  Response rewind(size_t n = 1);
+
+  /** How many steps rewind() can undo right now */
+  size_t rewind_depth() const;
+
+  /** Sets when cached query answers may be reused instead of asking the
+   *  client again, for methods the codex doesn't annotate with their own
+   *  policy. Defaults to PER_BEAT. */
+  void set_cache_policy(CachePolicy policy);
+
+  /** Binds a codex method to a C++ callable (function pointer, lambda, or
+   *  std::function) taking and returning string, bool, int or float (void
+   *  for ACTION methods). Bound methods run inside the engine instead of
+   *  going out as queries or posts. Errors if there's no codex, the codex has
+   *  no such method, or the signature doesn't match its MethodDef. Bindings
+   *  are dropped when a new codex is set up. */
+  template <typename F>
+  std::optional<Error> bind_method(const std::string &name, F fn) {
+    return bind_function(name, std::function(std::move(fn)));
+  }
+
   /// PROJECT STUFF ///
   std::optional<std::string> get_project_root();
   std::optional<std::string> get_codex_name();
@@ -936,8 +1475,9 @@ public:
   /// DEBUG STUFF ///
   std::string dbg_print_cache() {
     std::string ret;
-    for (const auto &[key, value] : query_cache) {
-      ret += key + ": " + rval_to_string(value) + "\n";
+    for (const auto &[key, cached] : *query_cache) {
+      ret += key.text + ": " +
+             (cached.val ? rval_to_string(*cached.val) : "<none>") + "\n";
     }
     return ret;
   }
@@ -946,66 +1486,181 @@ private:
   /** Main loop processor */
   Response next();
 
+  ///--  NATIVE METHODS  --///
+
+  /** Indexed like Codex::method_defs; empty where unbound. Shared with
+   *  forks. */
+  CopyOnWrite<std::vector<NativeMethod>> native_methods;
+
+  /** Checks a binding's signature against the codex and stores it */
+  std::optional<Error> bind_native(const std::string &name,
+                                   const std::vector<ValueType> &arg_types,
+                                   ValueType return_type, NativeMethod fn);
+
+  template <typename R, typename... Args>
+  std::optional<Error> bind_function(const std::string &name,
+                                     std::function<R(Args...)> fn) {
+    return bind_native(
+        name, {value_type_of<std::decay_t<Args>>()...}, value_type_of<R>(),
+        [fn = std::move(fn)](const std::vector<SimpleRValue> &args) {
+          return invoke_native(fn, args, std::index_sequence_for<Args...>{});
+        });
+  }
+
+  template <typename R, typename... Args, size_t... I>
+  static std::optional<SimpleRValue>
+  invoke_native(const std::function<R(Args...)> &fn,
+                const std::vector<SimpleRValue> &args,
+                std::index_sequence<I...>) {
+    (void)args; // unused for zero-arg methods
+    if constexpr (std::is_void_v<R>) {
+      fn(std::get<std::decay_t<Args>>(args[I])...);
+      return std::nullopt;
+    } else {
+      return SimpleRValue{fn(std::get<std::decay_t<Args>>(args[I])...)};
+    }
+  }
+
+  /** The native binding for a call, or nullptr if it goes to the client */
+  const NativeMethod *native_for(const MethodCall &call) const;
+
+  /** Resolves the call's arguments and runs it. Returns nullopt (and warns)
+   *  if an argument's runtime type doesn't match the codex. */
+  std::optional<SimpleRValue> call_native(const NativeMethod &native,
+                                          const MethodCall &call);
+
+  /** call_native for a getter, run at most once per step (see
+   *  Cursor::native_results) */
+  std::optional<SimpleRValue> native_answer(const NativeMethod &native,
+                                            const MethodCall &call);
+
   ///--  MODULE AND STATE  --///
 
   /** If codex is not present, globals and methods will not be available, and GO
    *  subfolder paths will not resolve properly. */
-  std::unique_ptr<Codex> codex;
+  std::shared_ptr<const Codex> codex;
 
   /** The currently loaded module */
-  std::unique_ptr<Module> current;
+  std::shared_ptr<const Module> current;
 
-  /** Source fetcher. Empty => filesystem default (default_source_reader). */
-  SourceReader reader_;
+  /** For a lazily loaded module, the block the cursor is in; null
+   *  otherwise. */
+  std::shared_ptr<const ParsedBlock> segment;
 
-  /** Not cleared */
-  std::unordered_map<std::string, SimpleRValue> global_state;
+  /** The code the cursor's pc is in: the current block's segment for a
+   *  lazily loaded module, else the module's Program. Needs a module. */
+  const Program &program() const;
 
-  /** Cleared on EXIT */
-  std::unordered_map<std::string, SimpleRValue> module_state;
+  /** Source fetcher; a SourceReader is wrapped into one. Empty => filesystem
+   *  default (default_source_reader). */
+  SourceViewReader reader_;
 
-  /** Cleared on every new module start */
-  std::unordered_map<std::string, SimpleRValue> local_state;
+  std::shared_ptr<ModuleCache> module_cache = ModuleCache::shared();
 
-  std::unordered_map<std::string, SimpleRValue> query_cache;
+  bool prefetch = false;
+  bool lazy_blocks = false;
 
-  /** Initializes state after a codex is loaded */
-  void init_state();
-  void build_state(const Module &module);
+  /** Prefetches queued for the current module hold a weak reference to this;
+   *  replacing or dropping it cancels those not started yet. */
+  std::shared_ptr<const bool> prefetch_owner;
+
+  /** Queues background loads of the GO targets in program on the shared
+   *  prefetch pool */
+  void prefetch_go_targets(const Program &program);
+
+  /** Indexed by codex global slot. Not cleared */
+  CopyOnWrite<std::vector<SimpleRValue>> global_state;
+
+  /** Module vars outlive the module that declared them (they thread through
+   *  GO), so they're stored engine-wide; module_slots maps name -> index. */
+  CopyOnWrite<std::vector<SimpleRValue>> module_state;
+  CopyOnWrite<std::unordered_map<std::string, uint32_t>> module_slots;
+
+  /** Where each of the current module's module_vars lives in module_state */
+  std::vector<uint32_t> module_binding;
+
+  /** Where each of the current module's local_vars lives in module_state, if
+   *  an earlier module declared it; NO_BINDING otherwise. */
+  std::vector<uint32_t> local_binding;
+  static constexpr uint32_t NO_BINDING = UINT32_MAX;
+
+  /** Indexed by local slot; nullopt until set. Cleared on every new module
+   *  start */
+  std::vector<std::optional<SimpleRValue>> local_state;
+
+  /** An answer from the client, stamped with when it was given */
+  struct CachedAnswer {
+    std::optional<SimpleRValue> val; // nullopt if answered with no value
+    uint64_t step;
+    uint64_t block_visit;
+  };
+  CopyOnWrite<std::unordered_map<QueryKey, CachedAnswer, QueryKey::Hash>>
+      query_cache;
+  CachePolicy cache_policy = CachePolicy::PER_BEAT;
 
-  ///--  UTIL  --///
-  // ConditionalChain *get_current_conditional_chain();
+  /** Set on preview forks: any cached answer counts, and native actions
+   *  are posted instead of run. */
+  bool sandboxed = false;
 
-  /** Gets the current block for the cursor */
-  Block &cursor_block();
+  /** Handed to each query as it's queued */
+  uint32_t next_ticket = 1;
 
-  /** Gets current MainBlockMember (BM or CT) where we already know block */
-  MainBlockMember &cursor_mbm(Block &block);
+  /** Bumped every time the cursor arrives on an instruction, and every time
+   *  it enters a block, so cached answers can be aged against the policy. */
+  uint64_t step = 0;
+  uint64_t block_visit = 0;
 
-  /** Gets current MainBlockMember (BM or CT) from scratch */
-  MainBlockMember &cursor_mbm();
+  /** The codex's policy for the call's method if it sets one, else the
+   *  engine's */
+  CachePolicy policy_for(const MethodCall &call) const;
 
-  /** Gets current BlockMember (Mem or CG), including in a CT, where we already
-   * know the parent MBM (which either is this, or is the parent) */
-  BlockMember &cursor_bm(MainBlockMember &mbm);
+  /** True if the call needn't be asked: answered on this step, or cached
+   *  recently enough for its cache policy. */
+  bool is_answered(const MethodCall *call);
 
-  /** Gets current BlockMember (Mem or CG), including in a CT, where we don't
-   * know the parent MBM (which either is this, or is the parent) */
-  BlockMember &cursor_bm();
+  /** The call's cache key: its prebuilt one if every arg is a literal, else
+   *  one built into scratch from the args' current values, so a call on a
+   *  variable isn't answered for a value it no longer has. */
+  const QueryKey &query_key(const MethodCall &call, QueryKey &scratch);
 
-  /** Gets current member; may be MBM:BM:Mem, may be child, or may be child of a
-   * choice in a CG. In this case we know the parent / superclass BM. */
-  Member &cursor_mem(BlockMember &bm);
+  /** Initializes state after a codex is loaded */
+  void init_state();
+  void build_state(const Module &module);
 
-  /** Gets current member; may be MBM:BM:Mem, may be child, or may be child of a
-   * choice in a CG. */
-  Member &cursor_mem();
+  ///--  CURSOR  --///
 
   /** This zeroes the state and drops us in at this beat index, e.g. from an
    *  external entry point. It also initializes Skald state, leaving extant
    *  state intact. */
   Response enter(int block, int beat);
 
+  /** Resets the cursor and module-local state onto a block's first
+   *  instruction, without running anything. Fails only if the block is
+   *  lazily loaded and has errors. */
+  std::optional<Error> enter_block(size_t block);
+
+  /** Moves the cursor to a block's first instruction: for a lazily loaded
+   *  module, into its segment, parsing it first if need be. */
+  std::optional<Error> go_to_block(uint32_t block);
+
+  /** Block of the lazily loaded current module, parsed (see lazy_block), or
+   *  its first error */
+  std::variant<Error, std::shared_ptr<const ParsedBlock>>
+  parsed_block(uint32_t block);
+
+  /** Extends the local bindings (and unset locals) to cover names, the
+   *  local table of the current module, without touching ones already
+   *  bound. */
+  void bind_locals(const std::vector<std::string> &names);
+
+  /** Moves the cursor to the instruction at pc, and queues any queries it
+   *  needs resolved before it can run. */
+  void setup(uint32_t pc);
+
+  /** Refills the resolution stack with whatever the current instruction's
+   *  conditions still need answered. */
+  void queue_queries();
+
   std::optional<Error> advance_cursor(int from_line_number = 0);
 
   ///--  ENGINE LOGIC FLOW  --///
@@ -1017,18 +1672,7 @@ private:
 
   /** Performs a mutation. Returns either error or a notification that can be
    *  sent directly to the client. */
-  std::variant<Error, Notification> do_mutation(Mutation &mut);
-
-  std::optional<Response> do_member(Member &mem);
-
-  /** Queues the member's conditional for processing. */
-  void setup_mbm(MainBlockMember &mbm);
-
-  /** Queues conditional for a bock member */
-  void setup_bm(BlockMember &bm);
-
-  /** Queues conditional, rvalue methods, or arg menus */
-  void setup_member(Member &member);
+  std::variant<Error, Notification> do_mutation(const Mutation &mut);
 
   ///-- RESOLUTION --///
 
@@ -1044,32 +1688,143 @@ private:
     return "unknown";
   }
 
-  struct ScopeMap {
+  /** Where a resolved Variable currently lives: an index into global_state,
+   *  module_state or local_state, by scope. found is false for a local that
+   *  hasn't been set yet, or a global the codex no longer has. */
+  struct VarRef {
     VarScope scope;
-    std::unordered_map<std::string, SimpleRValue> &map;
+    uint32_t index;
+    bool found;
+  };
+
+  /** Looks a variable up by its slot. A local whose name was declared by an
+   *  earlier module resolves to that module var. */
+  VarRef var_ref(const Variable &var) const;
+
+  /** The value a found ref points at */
+  const SimpleRValue &var_value(const VarRef &ref) const;
+
+  /** Stores val where ref points, copying state still shared with a fork
+   *  first, and marks it for the next delta. */
+  void var_write(const VarRef &ref, SimpleRValue val);
+
+  ///--  DELTA TRACKING  --///
+
+  /** Indices written since the last checkpoint, in order of first write */
+  struct DirtySet {
+    std::vector<uint32_t> indices;
+    std::vector<bool> marked;
+
+    void mark(uint32_t index) {
+      if (index >= marked.size())
+        marked.resize(index + 1);
+      if (!marked[index]) {
+        marked[index] = true;
+        indices.push_back(index);
+      }
+    }
+    void clear() {
+      indices.clear();
+      marked.clear();
+    }
+  };
+  DirtySet dirty_globals;
+  DirtySet dirty_module_vars;
+  std::unordered_set<QueryKey, QueryKey::Hash> dirty_answers;
+
+  /** Where the last checkpoint left the counters; a delta only applies to an
+   *  engine at exactly that point. */
+  bool has_checkpoint = false;
+  uint64_t checkpoint_step = 0;
+  uint64_t checkpoint_block_visit = 0;
+  uint32_t checkpoint_ticket = 0;
+
+  /** Records a write through ref for the next delta. Locals aren't tracked:
+   *  they're few, and every delta carries all of them. */
+  void mark_dirty(const VarRef &ref);
+
+  /** Makes the current state the base for the next delta */
+  void mark_checkpoint();
+
+  /** The module a snapshot or delta was saved on: the current one if the
+   *  path matches and it was loaded the same way, otherwise loaded. Null for
+   *  an empty path. On failure, holds why instead, including when the source
+   *  has changed since. */
+  std::variant<std::string, std::shared_ptr<const Module>>
+  saved_module(const std::string &path, uint64_t source_hash, bool lazy);
+
+  ///--  REWIND JOURNAL  --///
+
+  /** One step: how things stood before it, what it overwrote, and what it
+   *  returned. Locals are kept whole, as in deltas. */
+  struct JournalEntry {
+    Cursor cursor;
+    uint32_t next_ticket;
+    uint64_t step;
+    uint64_t block_visit;
+    std::shared_ptr<const Module> module;
+    std::shared_ptr<const ParsedBlock> segment;
+    std::vector<uint32_t> module_binding;
+    std::vector<uint32_t> local_binding;
+    std::vector<std::optional<SimpleRValue>> local_state;
+
+    /** Module vars only ever get appended (on a GO), so undoing that is
+     *  truncating back to this size and the slots from before. */
+    size_t module_state_size;
+    CopyOnWrite<std::unordered_map<std::string, uint32_t>> module_slots;
+
+    /** Old values of global and module vars, in the order they were
+     *  written */
+    std::vector<std::pair<VarRef, SimpleRValue>> vars;
+
+    /** Old cached answers; nullopt where there wasn't one */
+    std::vector<std::pair<QueryKey, std::optional<CachedAnswer>>> answers;
+
+    Response response;
+    size_t bytes = 0;
   };
+  std::deque<JournalEntry> journal;
+  size_t journal_limit = 0;
+  size_t journal_bytes = 0;
+
+  /** Set while a step is being recorded into journal.back() */
+  bool journaling = false;
+
+  /** Runs step as one journal entry. Public entry points call this on
+   *  themselves when the journal is on, so nested calls aren't recorded
+   *  twice. */
+  template <typename F> Response journaled(F step) {
+    begin_step();
+    Response response = step();
+    end_step(response);
+    return response;
+  }
+  void begin_step();
+
+  /** Closes the entry, then drops the oldest ones while over the limit */
+  void end_step(const Response &response);
 
-  /** Returns the scope maps in lookup-priority order: global, module, local. */
-  std::array<ScopeMap, 3> scopes();
+  /** Puts back everything entry recorded, newest change first */
+  void undo(JournalEntry &entry);
+  void clear_journal();
 
-  /** Gets a var, preferring global, module, then local. Gets false if local,
-   *  and warns. */
-  SimpleRValue var_get(const std::string var_name);
+  /** Gets a var. Gets false if it's an unset local, and warns. */
+  SimpleRValue var_get(const Variable &var);
 
-  /** Set a variable, preferring global, module, and then local var. Sets as
-   *  local if not exists. */
-  std::variant<Error, VarScope>
-  var_set(const std::string var_name, const SimpleRValue &rval, size_t ln = 0);
+  /** Set a variable, type-checked against its current value. Sets as local if
+   *  not exists. */
+  std::variant<Error, VarScope> var_set(const Variable &var,
+                                        const SimpleRValue &rval,
+                                        size_t ln = 0);
 
   /** Will switch a bool. Throws an error if not a bool, and a warning if not
    *  previously set (and sets to false in this case) */
-  std::variant<Error, VarScope> var_switch(const std::string var_name,
-                                           size_t ln = 0);
+  std::variant<Error, VarScope> var_switch(const Variable &var, size_t ln = 0);
 
   /** Will mathematically mutate a float or int. Errors if string or bool, or if
    * arg is string or bool. floats and ints can be used interchangeably (int -
    * float will round down). If sign is false, will subtract. */
-  std::variant<Error, VarScope> var_add(const std::string var_name,
+  std::variant<Error, VarScope> var_add(const Variable &var,
                                         const SimpleRValue &rval, bool sign,
                                         size_t ln = 0);
 
@@ -1079,6 +1834,11 @@ private:
   bool resolve_condition(const std::optional<Conditional> &cond);
   bool resolve_condition(const Conditional &cond);
   bool resolve_condition(const AttachedCondition &cond);
+
+  /** Walks cond the way resolve_condition does, short-circuiting AND/OR, and
+   *  returns the first method call it reaches that hasn't been answered yet;
+   *  nullptr once the condition is decided, with its value in result. */
+  const MethodCall *next_query(const Conditional &cond, bool &result);
   std::string resolve_simple(const SimpleInsertion &ins);
   std::string resolve_tern(const TernaryInsertion &tern);
   std::vector<Chunk> resolve_text(const TextContent &text_content);
@@ -1086,4 +1846,110 @@ private:
   Cursor cursor;
 };
 
+/** A fixed-size queue between exactly one producing thread and one consuming
+ *  thread. Neither side locks or waits: push() fails when it's full (and
+ *  leaves value alone), pop() when it's empty. */
+template <typename T> class SpscQueue {
+public:
+  explicit SpscQueue(size_t capacity) : slots(capacity + 1) {}
+
+  bool push(T &&value) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t next = (tail + 1) % slots.size();
+    if (next == head_.load(std::memory_order_acquire))
+      return false;
+    slots[tail] = std::move(value);
+    tail_.store(next, std::memory_order_release);
+    return true;
+  }
+
+  std::optional<T> pop() {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire))
+      return std::nullopt;
+    T value = std::move(slots[head]);
+    head_.store((head + 1) % slots.size(), std::memory_order_release);
+    return value;
+  }
+
+  bool empty() const {
+    return head_.load(std::memory_order_acquire) ==
+           tail_.load(std::memory_order_acquire);
+  }
+
+  bool full() const {
+    size_t next = (tail_.load(std::memory_order_acquire) + 1) % slots.size();
+    return next == head_.load(std::memory_order_acquire);
+  }
+
+private:
+  // One slot is always left free, to tell full from empty
+  std::vector<T> slots;
+  // On separate cache lines, so the two sides don't contend
+  alignas(64) std::atomic<size_t> head_{0};
+  alignas(64) std::atomic<size_t> tail_{0};
+};
+
+/** Starts the runner's engine: loads module first, unless it's empty, then
+ *  starts at tag, or at the top if that's empty. */
+struct StartAt {
+  std::string module;
+  std::string tag;
+};
+
+/** Undoes steps, as Engine::rewind does */
+struct Rewind {
+  size_t steps = 1;
+};
+
+/** What an EngineRunner can be told to do; each runs the Engine method of
+ *  the same shape. */
+using RunnerCommand =
+    std::variant<StartAt, Action, QueryAnswer, TicketAnswer, Rewind>;
+
+/** Runs an engine on a worker thread of its own, so module loads and long
+ *  runs of steps never stall the thread driving it (a game's main loop, say).
+ *  One thread submits commands and one polls responses, possibly the same
+ *  one; neither ever blocks. Each command produces exactly one response, in
+ *  order. */
+class EngineRunner {
+public:
+  /** Takes over an engine that's already set up (codex, bindings, cache);
+   *  nothing else may touch it afterwards. Bound natives run on the
+   *  worker. capacity bounds both queues. */
+  explicit EngineRunner(Engine engine, size_t capacity = 64);
+
+  /** Finishes the command in progress, then joins the worker. Commands not
+   *  yet started and responses not yet polled are dropped. */
+  ~EngineRunner();
+
+  EngineRunner(const EngineRunner &) = delete;
+  EngineRunner &operator=(const EngineRunner &) = delete;
+
+  /** Queues a command; false if the queue is full. */
+  bool submit(RunnerCommand command);
+
+  /** The next response, if one is ready. */
+  std::optional<Response> poll();
+
+private:
+  Engine engine;
+  SpscQueue<RunnerCommand> commands;
+  SpscQueue<Response> responses;
+
+  /** The worker sleeps on wake while it has nothing to do, or no room for
+   *  its response; submit() and poll() touch the mutex only when waiting
+   *  says it's asleep. */
+  std::atomic<bool> waiting{false};
+  std::atomic<bool> stopping{false};
+  std::mutex wake_mutex;
+  std::condition_variable wake;
+
+  // Started last, once everything it uses is constructed
+  std::thread worker;
+
+  void run();
+  Response execute(RunnerCommand &command);
+};
+
 } // namespace Skald
@@ -0,0 +1,63 @@
+#include "framing.h"
+#include <cerrno>
+#include <cstdint>
+#include <unistd.h>
+
+namespace SkaldServer {
+
+/** Reads exactly size bytes, retrying short reads. */
+static bool read_all(int fd, char *buf, size_t size) {
+  while (size > 0) {
+    ssize_t n = ::read(fd, buf, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    buf += n;
+    size -= n;
+  }
+  return true;
+}
+
+static bool write_all(int fd, const char *buf, size_t size) {
+  while (size > 0) {
+    ssize_t n = ::write(fd, buf, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    buf += n;
+    size -= n;
+  }
+  return true;
+}
+
+std::optional<std::string> read_frame(int fd) {
+  unsigned char header[4];
+  if (!read_all(fd, reinterpret_cast<char *>(header), sizeof(header))) {
+    return std::nullopt;
+  }
+  uint32_t size = header[0] | header[1] << 8 | header[2] << 16 |
+                  static_cast<uint32_t>(header[3]) << 24;
+  if (size > MAX_FRAME_SIZE) {
+    return std::nullopt;
+  }
+  std::string payload(size, '\0');
+  if (!read_all(fd, payload.data(), size)) {
+    return std::nullopt;
+  }
+  return payload;
+}
+
+bool write_frame(int fd, const std::string &payload) {
+  uint32_t size = payload.size();
+  std::string frame;
+  frame.reserve(4 + payload.size());
+  for (int i = 0; i < 4; i++) {
+    frame.push_back(static_cast<char>(size >> (8 * i)));
+  }
+  frame += payload;
+  return write_all(fd, frame.data(), frame.size());
+}
+
+} // namespace SkaldServer
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <optional>
+#include <string>
+
+namespace SkaldServer {
+
+/** Frames are a 4-byte little-endian payload length followed by the payload
+ *  (a JSON document). Frames over this size are refused. */
+constexpr size_t MAX_FRAME_SIZE = 16 * 1024 * 1024;
+
+/** Reads one frame from fd. nullopt on EOF, a read error, or an oversized
+ *  frame. */
+std::optional<std::string> read_frame(int fd);
+
+/** Writes one frame to fd. Returns false if the peer has gone away. */
+bool write_frame(int fd, const std::string &payload);
+
+} // namespace SkaldServer
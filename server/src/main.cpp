@@ -0,0 +1,139 @@
+#include "debug.h"
+#include "framing.h"
+#include "session_host.h"
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace SkaldServer;
+
+static void usage() {
+  std::cerr << "usage: skald_server [--socket PATH] [--threads N] "
+               "[project.codex]\n";
+}
+
+/** Reads frames from in until EOF, handing each to the host. Replies go out
+ *  on out whenever their request finishes, so they can arrive out of order;
+ *  clients match them up by id. */
+static void serve(SessionHost &host, int in, int out, bool owns_fds) {
+  // Outstanding replies keep the connection alive, so a socket is closed
+  // only once the last of them has been written.
+  struct Connection {
+    int fd;
+    bool owns_fd;
+    std::mutex mutex;
+    bool open = true;
+    ~Connection() {
+      if (owns_fd)
+        ::close(fd);
+    }
+  };
+  auto conn = std::make_shared<Connection>();
+  conn->fd = out;
+  conn->owns_fd = owns_fds;
+  Reply reply = [conn](const json &msg) {
+    std::string payload = msg.dump();
+    std::lock_guard<std::mutex> lock(conn->mutex);
+    if (conn->open && !write_frame(conn->fd, payload)) {
+      conn->open = false;
+    }
+  };
+
+  while (auto frame = read_frame(in)) {
+    json request = json::parse(*frame, nullptr, false);
+    if (request.is_discarded() || !request.is_object()) {
+      reply({{"id", nullptr}, {"ok", false}, {"error", "Malformed request"}});
+      continue;
+    }
+    // A bad request must never take down the other sessions.
+    try {
+      host.handle(request, reply);
+    } catch (const std::exception &e) {
+      reply({{"id", request.value("id", json())},
+             {"ok", false},
+             {"error", e.what()}});
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  // Silence all skald library logging: stdout may be the protocol channel.
+  Skald::log_level = Skald::SkaldLogLevel::OFF;
+  dbg_out_on = false;
+  dbg_always_cout = false;
+  dbg_sink = [](const std::string &) {};
+
+  std::string socket_path;
+  std::string codex_path;
+  size_t threads = std::thread::hardware_concurrency();
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--socket" && i + 1 < argc) {
+      socket_path = argv[++i];
+    } else if (arg == "--threads" && i + 1 < argc) {
+      threads = std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg.rfind("--", 0) == 0 || !codex_path.empty()) {
+      usage();
+      return 1;
+    } else {
+      codex_path = arg;
+    }
+  }
+
+  std::shared_ptr<const Skald::Codex> codex;
+  if (!codex_path.empty()) {
+    auto loaded = Skald::load_codex(codex_path);
+    if (!loaded.result.ok) {
+      std::cerr << "Couldn't load codex " << codex_path << "\n";
+      for (auto &ex : loaded.result.exceptions) {
+        std::cerr << "  " << ex.msg << "\n";
+      }
+      return 1;
+    }
+    codex = loaded.value;
+  }
+
+  // A client hanging up mid-reply should fail the write, not kill us.
+  std::signal(SIGPIPE, SIG_IGN);
+
+  SessionHost host(codex, threads);
+
+  if (socket_path.empty()) {
+    serve(host, STDIN_FILENO, STDOUT_FILENO, false);
+    return 0;
+  }
+
+  int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (listener < 0 || socket_path.size() >= sizeof(addr.sun_path)) {
+    std::cerr << "Couldn't create socket " << socket_path << "\n";
+    return 1;
+  }
+  socket_path.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+  ::unlink(socket_path.c_str());
+  if (::bind(listener, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) <
+          0 ||
+      ::listen(listener, SOMAXCONN) < 0) {
+    std::cerr << "Couldn't listen on " << socket_path << "\n";
+    return 1;
+  }
+
+  // One reader thread per connection; the steps themselves run on the pool.
+  while (true) {
+    int client = ::accept(listener, nullptr, nullptr);
+    if (client < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    std::thread([&host, client] { serve(host, client, client, true); })
+        .detach();
+  }
+  ::close(listener);
+  return 0;
+}
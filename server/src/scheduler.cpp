@@ -0,0 +1,115 @@
+#include "scheduler.h"
+
+namespace SkaldServer {
+
+/** The pool and worker index running on this thread, if any */
+static thread_local const WorkStealingPool *current_pool = nullptr;
+static thread_local size_t current_worker = 0;
+
+WorkStealingPool::WorkStealingPool(size_t threads) {
+  if (threads == 0)
+    threads = 1;
+  for (size_t i = 0; i < threads; i++) {
+    workers.push_back(std::make_unique<Worker>());
+  }
+  for (size_t i = 0; i < threads; i++) {
+    this->threads.emplace_back([this, i] { run(i); });
+  }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  stopping = true;
+  {
+    std::lock_guard<std::mutex> lock(idle_mutex);
+  }
+  idle.notify_all();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+void WorkStealingPool::submit(Task task) {
+  size_t target = current_pool == this
+                      ? current_worker
+                      : next_worker.fetch_add(1) % workers.size();
+  {
+    std::lock_guard<std::mutex> lock(workers[target]->mutex);
+    workers[target]->tasks.push_back(std::move(task));
+  }
+  queued++;
+  // Taking the lock orders this against a worker checking queued before it
+  // sleeps, so the wakeup can't be lost.
+  {
+    std::lock_guard<std::mutex> lock(idle_mutex);
+  }
+  idle.notify_one();
+}
+
+bool WorkStealingPool::take(size_t self, Task &task) {
+  {
+    auto &own = *workers[self];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.tasks.empty()) {
+      task = std::move(own.tasks.back());
+      own.tasks.pop_back();
+      return true;
+    }
+  }
+  for (size_t i = 1; i < workers.size(); i++) {
+    auto &victim = *workers[(self + i) % workers.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+void WorkStealingPool::run(size_t self) {
+  current_pool = this;
+  current_worker = self;
+  while (true) {
+    Task task;
+    if (take(self, task)) {
+      queued--;
+      task();
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(idle_mutex);
+    idle.wait(lock, [&] { return queued > 0 || stopping; });
+    if (stopping && queued == 0)
+      return;
+  }
+}
+
+// SECTION: STRAND
+
+void Strand::post(Task task) {
+  std::lock_guard<std::mutex> lock(mutex);
+  tasks.push_back(std::move(task));
+  if (!scheduled) {
+    scheduled = true;
+    pool.submit([self = shared_from_this()] { self->run_one(); });
+  }
+}
+
+void Strand::run_one() {
+  Task task;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    task = std::move(tasks.front());
+    tasks.pop_front();
+  }
+  task();
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (tasks.empty()) {
+    scheduled = false;
+    return;
+  }
+  pool.submit([self = shared_from_this()] { self->run_one(); });
+}
+
+} // namespace SkaldServer
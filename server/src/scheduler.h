@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace SkaldServer {
+
+using Task = std::function<void()>;
+
+/** A fixed set of worker threads, each with its own task deque. A worker runs
+ *  its newest task first (it's the one most likely still in cache) and, when
+ *  it runs dry, steals the oldest task from another worker. Tasks submitted
+ *  from outside the pool are spread round-robin. */
+class WorkStealingPool {
+public:
+  explicit WorkStealingPool(size_t threads);
+
+  /** Runs every task already submitted (and any they submit), then joins. */
+  ~WorkStealingPool();
+
+  void submit(Task task);
+
+  size_t size() const { return workers.size(); }
+
+private:
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::vector<std::thread> threads;
+
+  /** Tasks submitted but not yet taken, so idle workers know to look */
+  std::atomic<size_t> queued{0};
+  std::atomic<size_t> next_worker{0};
+  std::atomic<bool> stopping{false};
+  std::mutex idle_mutex;
+  std::condition_variable idle;
+
+  /** Takes a task: self's newest, else the oldest from anyone else's */
+  bool take(size_t self, Task &task);
+  void run(size_t self);
+};
+
+/** Runs the tasks posted to it one at a time, in posting order, on a pool;
+ *  different strands run in parallel. Each session gets one, so an engine is
+ *  never touched by two threads at once. */
+class Strand : public std::enable_shared_from_this<Strand> {
+public:
+  explicit Strand(WorkStealingPool &pool) : pool(pool) {}
+
+  void post(Task task);
+
+private:
+  WorkStealingPool &pool;
+  std::mutex mutex;
+  std::deque<Task> tasks;
+  bool scheduled = false;
+
+  /** Runs one task, then reschedules itself if more are waiting, so a busy
+   *  session can't hold a worker while others wait. */
+  void run_one();
+};
+
+} // namespace SkaldServer
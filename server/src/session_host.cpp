@@ -0,0 +1,285 @@
+#include "session_host.h"
+#include <stdexcept>
+
+namespace SkaldServer {
+
+// SECTION: ENCODING
+
+static json value_to_json(const Skald::SimpleRValue &val) {
+  return std::visit([](const auto &v) -> json { return v; }, val);
+}
+
+static std::optional<Skald::SimpleRValue> json_to_value(const json &val) {
+  if (val.is_string())
+    return val.get<std::string>();
+  if (val.is_boolean())
+    return val.get<bool>();
+  if (val.is_number_integer())
+    return val.get<int>();
+  if (val.is_number())
+    return val.get<float>();
+  return std::nullopt;
+}
+
+static std::string stitch(const std::vector<Skald::Chunk> &chunks) {
+  std::string text;
+  for (auto &chunk : chunks) {
+    text += chunk.text;
+  }
+  return text;
+}
+
+static json call_to_json(const char *type, const Skald::MethodCall &call) {
+  json args = json::array();
+  for (auto &arg : call.args) {
+    args.push_back(Skald::rval_to_string(arg));
+  }
+  return {{"type", type}, {"method", call.method}, {"args", args}};
+}
+
+static json response_to_json(const Skald::Response &response) {
+  return std::visit(
+      [](const auto &r) -> json {
+        using T = std::decay_t<decltype(r)>;
+        if constexpr (std::is_same_v<T, Skald::Content>) {
+          return {{"type", "content"},
+                  {"text", stitch(r.text)},
+                  {"attribution", r.attribution}};
+        } else if constexpr (std::is_same_v<T, Skald::OptionGroup>) {
+          json options = json::array();
+          for (auto &opt : r.options) {
+            options.push_back(
+                {{"text", stitch(opt.text)}, {"available", opt.is_available}});
+          }
+          return {{"type", "options"}, {"options", options}};
+        } else if constexpr (std::is_same_v<T, Skald::MethodCallGet>) {
+          json ret = call_to_json("query", r.call);
+          ret["ticket"] = r.ticket;
+          return ret;
+        } else if constexpr (std::is_same_v<T, Skald::MethodCallPost>) {
+          return call_to_json("post", r.call);
+        } else if constexpr (std::is_same_v<T, Skald::Notification>) {
+          return {{"type", "notification"},
+                  {"var", r.var_name},
+                  {"op", Skald::Mutation::label_for_type(r.mut_type)},
+                  {"value", r.rval ? value_to_json(*r.rval) : json()},
+                  {"scope", Skald::scope_to_str(r.scope)}};
+        } else if constexpr (std::is_same_v<T, Skald::GoModule>) {
+          return {{"type", "go"},
+                  {"module", r.module_path},
+                  {"tag", r.start_in_tag}};
+        } else if constexpr (std::is_same_v<T, Skald::Exit>) {
+          std::optional<Skald::SimpleRValue> val;
+          if (r.argument)
+            val = Skald::cast_rval_to_simple(*r.argument);
+          return {{"type", "exit"},
+                  {"value", val ? value_to_json(*val) : json()}};
+        } else if constexpr (std::is_same_v<T, Skald::End>) {
+          return {{"type", "end"}};
+        } else if constexpr (std::is_same_v<T, Skald::Error>) {
+          return {{"type", "error"},
+                  {"code", r.code},
+                  {"message", r.message},
+                  {"line", r.line_number}};
+        }
+      },
+      response);
+}
+
+// SECTION: STATS
+
+void Stats::record(uint64_t latency_us, bool ok) {
+  requests++;
+  if (!ok)
+    errors++;
+  latency_total_us += latency_us;
+  uint64_t max = latency_max_us;
+  while (latency_us > max &&
+         !latency_max_us.compare_exchange_weak(max, latency_us)) {
+  }
+  size_t bucket = 0;
+  while (bucket < BUCKET_LIMITS_US.size() &&
+         latency_us >= BUCKET_LIMITS_US[bucket]) {
+    bucket++;
+  }
+  latency_buckets[bucket]++;
+}
+
+json Stats::to_json() const {
+  double uptime = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - started)
+                      .count();
+  uint64_t count = requests;
+  json buckets = json::array();
+  for (auto &bucket : latency_buckets) {
+    buckets.push_back(bucket.load());
+  }
+  return {{"requests", count},
+          {"errors", errors.load()},
+          {"sessions_open", sessions_opened - sessions_closed},
+          {"sessions_opened", sessions_opened.load()},
+          {"uptime_s", uptime},
+          {"requests_per_s", uptime > 0 ? count / uptime : 0.0},
+          {"latency_avg_us", count ? latency_total_us / count : 0},
+          {"latency_max_us", latency_max_us.load()},
+          {"latency_bucket_limits_us", BUCKET_LIMITS_US},
+          {"latency_buckets", buckets}};
+}
+
+// SECTION: SESSIONS
+
+SessionHost::SessionHost(std::shared_ptr<const Skald::Codex> codex,
+                         size_t threads)
+    : codex(std::move(codex)), pool(threads) {}
+
+std::shared_ptr<SessionHost::Session> SessionHost::find(uint64_t id) {
+  std::lock_guard<std::mutex> lock(sessions_mutex);
+  auto it = sessions.find(id);
+  return it != sessions.end() ? it->second : nullptr;
+}
+
+void SessionHost::run_on(std::shared_ptr<Session> session,
+                         const json &request, Reply reply,
+                         std::function<json(Session &)> body) {
+  auto received = std::chrono::steady_clock::now();
+  session->strand->post([this, session, request, reply = std::move(reply),
+                         body = std::move(body), received] {
+    json ret;
+    bool ok = true;
+    try {
+      std::string op = request.value("op", "");
+      if (!session->ready && op != "open" && op != "close") {
+        throw std::runtime_error("Session isn't open");
+      }
+      ret = body(*session);
+    } catch (const std::exception &e) {
+      ok = false;
+      ret = {{"error", e.what()}};
+    }
+    ret["id"] = request.value("id", json());
+    ret["ok"] = ok;
+    reply(ret);
+    auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - received);
+    stats_.record(latency.count(), ok);
+  });
+}
+
+json SessionHost::open(Session &session, const json &request) {
+  auto &engine = session.engine;
+  engine.setup(codex);
+  engine.set_module_cache(module_cache);
+  auto res = engine.load(request.at("module").get<std::string>());
+  if (!res.ok) {
+    std::string msg = "Couldn't load module";
+    for (auto &ex : res.exceptions) {
+      if (ex.severity == Skald::ParseError::ERROR) {
+        msg += ": " + ex.msg;
+        break;
+      }
+    }
+    throw std::runtime_error(msg);
+  }
+  std::string tag = request.value("tag", "");
+  auto response = tag.empty() ? engine.start() : engine.start_at(tag);
+  session.ready = true;
+  return {{"response", response_to_json(response)}};
+}
+
+void SessionHost::handle(const json &request, Reply reply) {
+  std::string op = request.value("op", "");
+  auto fail = [&](const std::string &msg) {
+    stats_.record(0, false);
+    reply({{"id", request.value("id", json())}, {"ok", false}, {"error", msg}});
+  };
+
+  if (op == "stats") {
+    json ret = stats_.to_json();
+    ret["threads"] = pool.size();
+    reply({{"id", request.value("id", json())}, {"ok", true}, {"stats", ret}});
+    return;
+  }
+
+  if (op == "open") {
+    if (!request.contains("module")) {
+      return fail("open needs a module");
+    }
+    auto session = std::make_shared<Session>();
+    session->strand = std::make_shared<Strand>(pool);
+    uint64_t id;
+    {
+      std::lock_guard<std::mutex> lock(sessions_mutex);
+      id = next_session++;
+      sessions[id] = session;
+    }
+    stats_.sessions_opened++;
+    run_on(session, request, std::move(reply),
+           [this, id, request](Session &s) {
+             try {
+               json ret = open(s, request);
+               ret["session"] = id;
+               return ret;
+             } catch (...) {
+               // A close may have got here first and counted it already
+               size_t erased;
+               {
+                 std::lock_guard<std::mutex> lock(sessions_mutex);
+                 erased = sessions.erase(id);
+               }
+               stats_.sessions_closed += erased;
+               throw;
+             }
+           });
+    return;
+  }
+
+  auto session = find(request.value("session", uint64_t(0)));
+  if (!session) {
+    return fail("No such session");
+  }
+
+  if (op == "act") {
+    int choice = request.value("choice", 0);
+    run_on(session, request, std::move(reply), [choice](Session &s) {
+      return json{{"response", response_to_json(s.engine.act(choice))}};
+    });
+  } else if (op == "answer") {
+    std::optional<Skald::SimpleRValue> val;
+    if (request.contains("value"))
+      val = json_to_value(request["value"]);
+    Skald::QueryAnswer answer{.val = val};
+    if (request.contains("ticket")) {
+      uint32_t ticket = request["ticket"].get<uint32_t>();
+      run_on(session, request, std::move(reply), [ticket, answer](Session &s) {
+        return json{
+            {"response", response_to_json(s.engine.answer(ticket, answer))}};
+      });
+    } else {
+      run_on(session, request, std::move(reply), [answer](Session &s) {
+        return json{{"response", response_to_json(s.engine.answer(answer))}};
+      });
+    }
+  } else if (op == "pending") {
+    run_on(session, request, std::move(reply), [](Session &s) {
+      json queries = json::array();
+      for (auto &q : s.engine.pending_queries()) {
+        queries.push_back(response_to_json(q));
+      }
+      return json{{"queries", queries}};
+    });
+  } else if (op == "close") {
+    size_t erased;
+    {
+      std::lock_guard<std::mutex> lock(sessions_mutex);
+      erased = sessions.erase(request.value("session", uint64_t(0)));
+    }
+    stats_.sessions_closed += erased;
+    // Still runs after anything already queued for it
+    run_on(session, request, std::move(reply),
+           [](Session &) { return json(); });
+  } else {
+    fail("Unknown op: " + op);
+  }
+}
+
+} // namespace SkaldServer
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "scheduler.h"
+#include "skald.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <unordered_map>
+
+namespace SkaldServer {
+
+using json = nlohmann::json;
+
+/** Sends a reply back to whichever client made the request */
+using Reply = std::function<void(const json &)>;
+
+/** Throughput and latency counters, updated lock-free from every worker.
+ *  Latency runs from a request being decoded to its reply being handed to
+ *  the connection, so it includes time spent queued behind the session. */
+struct Stats {
+  std::atomic<uint64_t> requests{0};
+  std::atomic<uint64_t> errors{0};
+  std::atomic<uint64_t> sessions_opened{0};
+  std::atomic<uint64_t> sessions_closed{0};
+  std::atomic<uint64_t> latency_total_us{0};
+  std::atomic<uint64_t> latency_max_us{0};
+
+  /** Requests by latency: < 100us, < 1ms, < 10ms, < 100ms, and the rest */
+  static constexpr std::array<uint64_t, 4> BUCKET_LIMITS_US = {100, 1000,
+                                                               10000, 100000};
+  std::array<std::atomic<uint64_t>, 5> latency_buckets{};
+
+  std::chrono::steady_clock::time_point started =
+      std::chrono::steady_clock::now();
+
+  void record(uint64_t latency_us, bool ok);
+  json to_json() const;
+};
+
+/** Hosts any number of engine sessions over one shared codex and module
+ *  cache. Requests for a session run in order on its strand; different
+ *  sessions run in parallel on the pool. */
+class SessionHost {
+public:
+  SessionHost(std::shared_ptr<const Skald::Codex> codex, size_t threads);
+
+  /** Handles one decoded request; reply may be called from any worker
+   *  thread, after this returns. */
+  void handle(const json &request, Reply reply);
+
+  const Stats &stats() const { return stats_; }
+
+private:
+  struct Session {
+    Skald::Engine engine;
+    std::shared_ptr<Strand> strand;
+    /** Set once open succeeds; requests queued behind a failed open
+     *  mustn't step an engine with nothing loaded. */
+    bool ready = false;
+  };
+
+  std::shared_ptr<const Skald::Codex> codex;
+  std::shared_ptr<Skald::ModuleCache> module_cache =
+      std::make_shared<Skald::ModuleCache>();
+
+  std::mutex sessions_mutex;
+  std::unordered_map<uint64_t, std::shared_ptr<Session>> sessions;
+  uint64_t next_session = 1;
+
+  Stats stats_;
+
+  // Declared last: its destructor runs outstanding requests, which use
+  // everything above.
+  WorkStealingPool pool;
+
+  std::shared_ptr<Session> find(uint64_t id);
+
+  /** Runs a request body on the session's strand, timing it and wrapping
+   *  what it returns (or throws) into a reply. */
+  void run_on(std::shared_ptr<Session> session, const json &request,
+              Reply reply, std::function<json(Session &)> body);
+
+  json open(Session &session, const json &request);
+};
+
+} // namespace SkaldServer
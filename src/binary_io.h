@@ -0,0 +1,159 @@
+#pragma once
+#include "skald.h"
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+namespace Skald {
+
+/** Little-endian encoding shared by snapshots, deltas and compiled modules.
+ *  Strings are a u32 length then bytes; values are a u8 type in ValueType
+ *  order, then a string, u8 bool, i32 or f32. */
+struct Writer {
+  std::vector<uint8_t> out;
+
+  template <typename T> void num(T val) {
+    for (size_t i = 0; i < sizeof(T); i++) {
+      out.push_back(static_cast<uint8_t>(val >> (8 * i)));
+    }
+  }
+  void str(const std::string &s) {
+    num<uint32_t>(s.size());
+    out.insert(out.end(), s.begin(), s.end());
+  }
+  void value(const SimpleRValue &val) {
+    num<uint8_t>(val.index());
+    std::visit(
+        [&](const auto &v) {
+          using T = std::decay_t<decltype(v)>;
+          if constexpr (std::is_same_v<T, std::string>) {
+            str(v);
+          } else if constexpr (std::is_same_v<T, bool>) {
+            num<uint8_t>(v);
+          } else if constexpr (std::is_same_v<T, int>) {
+            num<uint32_t>(static_cast<uint32_t>(v));
+          } else if constexpr (std::is_same_v<T, float>) {
+            uint32_t bits;
+            std::memcpy(&bits, &v, sizeof(bits));
+            num<uint32_t>(bits);
+          }
+        },
+        val);
+  }
+};
+
+/** Reads what Writer wrote. Running off the end (or any bad byte) sets ok to
+ *  false and returns zeroes from then on, so callers check ok once at the
+ *  end instead of after every read. */
+struct Reader {
+  const uint8_t *data;
+  size_t size;
+  size_t pos = 0;
+  bool ok = true;
+
+  explicit Reader(const std::vector<uint8_t> &in)
+      : data(in.data()), size(in.size()) {}
+  explicit Reader(std::string_view in)
+      : data(reinterpret_cast<const uint8_t *>(in.data())), size(in.size()) {}
+  Reader(const uint8_t *data, size_t size) : data(data), size(size) {}
+
+  template <typename T> T num() {
+    if (!ok || size - pos < sizeof(T)) {
+      ok = false;
+      return 0;
+    }
+    T val = 0;
+    for (size_t i = 0; i < sizeof(T); i++) {
+      val |= static_cast<T>(data[pos++]) << (8 * i);
+    }
+    return val;
+  }
+  std::string str() {
+    auto len = num<uint32_t>();
+    if (!ok || size - pos < len) {
+      ok = false;
+      return "";
+    }
+    std::string s(reinterpret_cast<const char *>(data + pos), len);
+    pos += len;
+    return s;
+  }
+  SimpleRValue value() {
+    switch (num<uint8_t>()) {
+    case STRING:
+      return str();
+    case BOOL:
+      return num<uint8_t>() != 0;
+    case INT:
+      return static_cast<int>(num<uint32_t>());
+    case FLOAT: {
+      uint32_t bits = num<uint32_t>();
+      float f;
+      std::memcpy(&f, &bits, sizeof(f));
+      return f;
+    }
+    default:
+      ok = false;
+      return false;
+    }
+  }
+  /** The next byte, without consuming it */
+  uint8_t peek() {
+    if (!ok || pos >= size) {
+      ok = false;
+      return 0;
+    }
+    return data[pos];
+  }
+  /** A count of things at least min_size bytes each; guards reserve()
+   *  against lengths a truncated or corrupt blob couldn't hold. */
+  uint32_t count(size_t min_size) {
+    auto n = num<uint32_t>();
+    if (ok && n > (size - pos) / min_size) {
+      ok = false;
+      return 0;
+    }
+    return n;
+  }
+};
+
+/** Checks the magic and version; returns why not if they don't match. */
+inline std::optional<std::string> read_header(Reader &r,
+                                              const char (&magic)[4],
+                                              uint16_t expected,
+                                              const char *what) {
+  if (r.size < 4 || std::memcmp(r.data, magic, 4) != 0) {
+    return std::string("not a Skald ") + what + ".";
+  }
+  r.pos = 4;
+  auto version = r.num<uint16_t>();
+  if (r.ok && version != expected) {
+    return "it's version " + std::to_string(version) +
+           ", but this engine reads version " + std::to_string(expected) +
+           ".";
+  }
+  return std::nullopt;
+}
+
+/** True if bytes start with magic, i.e. they're that kind of blob rather
+ *  than source text. */
+inline bool has_magic(std::string_view bytes, const char (&magic)[4]) {
+  return bytes.size() >= 4 && std::memcmp(bytes.data(), magic, 4) == 0;
+}
+
+/** 64-bit FNV-1a: unlike std::hash, stable across builds and platforms, so
+ *  it can be saved with snapshots and compiled modules. */
+inline uint64_t fnv1a(const void *data, size_t size,
+                      uint64_t hash = 14695981039346656037ull) {
+  auto *bytes = static_cast<const unsigned char *>(data);
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+} // namespace Skald
@@ -135,9 +135,12 @@ template <> struct codex_action<declaration> {
       v = get_zero(t);
     }
     auto n = state.pop_id(); // grab var name
-    auto var = Variable{.name = n, .type = t};
+    auto slot = (uint32_t)state.codex.global_vars.size();
+    auto var = Variable{
+        .name = n, .type = t, .scope = VarScope::GLOBAL, .slot = slot};
 
-    // Add to stack
+    // Add to stack; a redeclared name takes the later slot
+    state.codex.global_slots[n] = slot;
     state.codex.global_vars.push_back(
         DeclaredVar{.initial_value = v, .var = var});
 
@@ -155,6 +158,7 @@ template <> struct codex_action<method_id> {
   static void apply(const CodexActionInput &input, CodexParseState &state) {
     dbg_out("-- method_id: " + input.string());
     state.method_id_buffer = input.string();
+    state.cache_policy_buffer.reset(); // in case a failed def left one
   }
 };
 
@@ -165,6 +169,27 @@ template <> struct codex_action<arg_def> {
   }
 };
 
+template <> struct codex_action<cache_pure> {
+  static void apply0(CodexParseState &state) {
+    state.cache_policy_buffer = CachePolicy::PURE;
+  }
+};
+template <> struct codex_action<cache_per_beat> {
+  static void apply0(CodexParseState &state) {
+    state.cache_policy_buffer = CachePolicy::PER_BEAT;
+  }
+};
+template <> struct codex_action<cache_per_block> {
+  static void apply0(CodexParseState &state) {
+    state.cache_policy_buffer = CachePolicy::PER_BLOCK;
+  }
+};
+template <> struct codex_action<cache_never> {
+  static void apply0(CodexParseState &state) {
+    state.cache_policy_buffer = CachePolicy::NEVER;
+  }
+};
+
 template <> struct codex_action<method_def> {
   template <typename CodexActionInput>
   static void apply(const CodexActionInput &input, CodexParseState &state) {
@@ -173,6 +198,12 @@ template <> struct codex_action<method_def> {
     def.name = std::move(state.method_id_buffer);
     def.args = std::move(state.arg_buffer);
     def.return_type = state.last_type;
+    def.cache_policy = std::exchange(state.cache_policy_buffer, std::nullopt);
+    if (def.cache_policy && def.return_type == ValueType::ACTION) {
+      state.warn(input.position(),
+                 "Action methods return nothing to cache; the cache policy "
+                 "on " + def.name + " has no effect.");
+    }
     state.codex.method_defs.push_back(std::move(def));
   }
 };
@@ -30,8 +30,19 @@ struct methods_close : seq<keyword_end, functional_eol> {};
 struct arg_def : seq<identifier, sp, value_type> {};
 struct arg_def_list : list<arg_def, arg_separator> {};
 struct method_id : identifier {};
-struct method_def : seq<indent, method_id, paren<opt<arg_def_list>>, sp,
-                        method_signature, functional_eol> {};
+
+/** Optional trailing annotation saying how long an answer may be reused */
+struct cache_pure : keyword<'@', 'p', 'u', 'r', 'e'> {};
+struct cache_per_beat : keyword<'@', 'p', 'e', 'r', '_', 'b', 'e', 'a', 't'> {};
+struct cache_per_block
+    : keyword<'@', 'p', 'e', 'r', '_', 'b', 'l', 'o', 'c', 'k'> {};
+struct cache_never : keyword<'@', 'n', 'e', 'v', 'e', 'r'> {};
+struct cache_annotation
+    : sor<cache_pure, cache_per_beat, cache_per_block, cache_never> {};
+
+struct method_def
+    : seq<indent, method_id, paren<opt<arg_def_list>>, sp, method_signature,
+          opt<sp, cache_annotation>, functional_eol> {};
 struct methods
     : seq<methods_open, star<sor<ignored, method_def, codex_malformed_line>>,
           methods_close> {};
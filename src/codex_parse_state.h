@@ -2,6 +2,7 @@
 #include "parse_state.h"
 #include "skald.h"
 #include <filesystem>
+#include <optional>
 #include <string>
 
 namespace Skald {
@@ -48,6 +49,7 @@ struct CodexParseState {
 
   std::vector<ArgDef> arg_buffer;
   std::string method_id_buffer;
+  std::optional<CachePolicy> cache_policy_buffer;
 
   // SECTION: CONSTRUCTION
 
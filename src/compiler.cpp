@@ -0,0 +1,317 @@
+#include "compiler.h"
+#include "debug.h"
+#include "skald.h"
+#include <variant>
+
+namespace Skald {
+
+// SECTION: LINKING
+
+std::vector<ParseError> link_block(const Module &module, Block &block) {
+  std::vector<ParseError> errors;
+  auto link = [&](Member &mem) {
+    auto *move = std::get_if<Move>(&mem.body);
+    if (!move) {
+      return;
+    }
+    move->target_block = module.get_block_index(move->target_tag);
+    if (move->target_block < 0) {
+      errors.push_back(ParseError{
+          .pos = ParsePosition{.line = move->line_number,
+                               .column = 0,
+                               .source = module.filename},
+          .msg = "Move target not found: " + move->target_tag});
+    }
+  };
+  auto link_bm = [&](BlockMember &bm) {
+    if (auto *mem = std::get_if<Member>(&bm)) {
+      link(*mem);
+      return;
+    }
+    for (auto &choice : std::get<ChoiceGroup>(bm).choices) {
+      for (auto &mem : choice.members) {
+        link(mem);
+      }
+    }
+  };
+  for (auto &mbm : block.members) {
+    if (auto *bm = std::get_if<BlockMember>(&mbm)) {
+      link_bm(*bm);
+      continue;
+    }
+    for (auto &cb : std::get<ConditionalChain>(mbm).cond_blocks) {
+      for (auto &bm : cb.members) {
+        link_bm(bm);
+      }
+    }
+  }
+  return errors;
+}
+
+std::vector<ParseError> link_module(Module &module) {
+  std::vector<ParseError> errors;
+  for (auto &block : module.blocks) {
+    auto block_errors = link_block(module, block);
+    errors.insert(errors.end(), block_errors.begin(), block_errors.end());
+  }
+  return errors;
+}
+
+// SECTION: LOWERING
+
+namespace {
+
+struct Compiler {
+  Program program;
+
+  uint32_t pc() const { return static_cast<uint32_t>(program.code.size()); }
+
+  /** Appends the method calls a condition needs answered, in order. */
+  void collect_queries(const Conditional &cond) {
+    for (const auto &item : cond.items) {
+      if (auto *atom = std::get_if<ConditionalAtom>(&item)) {
+        if (const MethodCall *a = rval_get_call(atom->a))
+          program.queries.push_back(a);
+        if (const MethodCall *b = atom->b ? rval_get_call(*atom->b) : nullptr)
+          program.queries.push_back(b);
+      } else if (auto *nested =
+                     std::get_if<std::shared_ptr<Conditional>>(&item)) {
+        collect_queries(**nested);
+      }
+    }
+  }
+
+  void collect_queries(const AttachedCondition &ac) {
+    if (ac.condition) {
+      collect_queries(*ac.condition);
+    }
+  }
+
+  /** Gives ins the manifest of every query it might need before it can run:
+   *  a choice group's choice conditions, a branch's condition, or a member's
+   *  attached condition. Which of them actually get asked is up to the
+   *  engine's short-circuiting. */
+  void build_manifest(Instruction &ins) {
+    ins.query_begin = static_cast<uint32_t>(program.queries.size());
+    if (ins.op == Instruction::CHOICES) {
+      for (const auto &choice : ins.group->choices) {
+        collect_queries(choice.condition);
+      }
+    } else if (ins.op == Instruction::BRANCH) {
+      collect_queries(*ins.cond);
+    } else if (ins.ac) {
+      collect_queries(*ins.ac);
+    }
+    ins.query_count =
+        static_cast<uint32_t>(program.queries.size()) - ins.query_begin;
+  }
+
+  uint32_t emit(Instruction ins) {
+    build_manifest(ins);
+    program.code.push_back(ins);
+    return pc() - 1;
+  }
+
+  /** Lowers a member to its instruction, carrying its attached condition. */
+  void emit_member(const Member &mem) {
+    Instruction ins{};
+    ins.line_number = mem.line_number;
+    ins.ac = mem.ac ? &mem.ac : nullptr;
+    std::visit(
+        [&](const auto &m) {
+          using T = std::decay_t<decltype(m)>;
+          if constexpr (std::is_same_v<T, Beat>) {
+            ins.op = Instruction::BEAT;
+            ins.beat = &m;
+          } else if constexpr (std::is_same_v<T, Move>) {
+            ins.op = Instruction::MOVE;
+            ins.move = &m;
+          } else if constexpr (std::is_same_v<T, MethodCall>) {
+            ins.op = Instruction::CALL;
+            ins.call = &m;
+          } else if constexpr (std::is_same_v<T, Mutation>) {
+            ins.op = Instruction::MUTATE;
+            ins.mutation = &m;
+          } else if constexpr (std::is_same_v<T, GoModule>) {
+            ins.op = Instruction::GO;
+            ins.go = &m;
+          } else if constexpr (std::is_same_v<T, Exit>) {
+            ins.op = Instruction::EXIT;
+            ins.exit = &m;
+          }
+        },
+        mem.body);
+    emit(ins);
+  }
+
+  /** CHOICES, then each choice's members followed by a jump past the group.
+   *  The last choice falls through instead. */
+  void emit_choice_group(const ChoiceGroup &cg) {
+    Instruction ins{};
+    ins.op = Instruction::CHOICES;
+    ins.line_number = cg.line_number;
+    ins.group = &cg;
+    ins.target = static_cast<uint32_t>(program.choice_targets.size());
+    emit(ins);
+
+    size_t first = program.choice_targets.size();
+    program.choice_targets.resize(first + cg.choices.size());
+
+    std::vector<uint32_t> exits;
+    for (size_t i = 0; i < cg.choices.size(); i++) {
+      program.choice_targets[first + i] = pc();
+      for (auto &mem : cg.choices[i].members) {
+        emit_member(mem);
+      }
+      if (i + 1 < cg.choices.size()) {
+        exits.push_back(emit(Instruction{.op = Instruction::JUMP}));
+      }
+    }
+    for (auto at : exits) {
+      program.code[at].target = pc();
+    }
+  }
+
+  void emit_block_member(const BlockMember &bm) {
+    if (auto *mem = std::get_if<Member>(&bm)) {
+      emit_member(*mem);
+    } else {
+      emit_choice_group(std::get<ChoiceGroup>(bm));
+    }
+  }
+
+  void emit_block(const Block &block) {
+    for (auto &mbm : block.members) {
+      if (auto *bm = std::get_if<BlockMember>(&mbm)) {
+        emit_block_member(*bm);
+      } else {
+        emit_chain(std::get<ConditionalChain>(mbm));
+      }
+    }
+  }
+
+  /** Each conditional block becomes BRANCH (unless it's an else) + members +
+   *  a jump to the end of the chain. A failed BRANCH skips to the next
+   *  conditional block, or out of the chain if it was the last one. */
+  void emit_chain(const ConditionalChain &chain) {
+    std::vector<uint32_t> exits;
+    for (auto &cb : chain.cond_blocks) {
+      std::optional<uint32_t> branch;
+      if (cb.cond) {
+        Instruction ins{};
+        ins.op = Instruction::BRANCH;
+        ins.line_number = cb.line_number;
+        ins.cond = &*cb.cond.condition;
+        branch = emit(ins);
+      }
+      for (auto &bm : cb.members) {
+        emit_block_member(bm);
+      }
+      exits.push_back(emit(Instruction{.op = Instruction::JUMP}));
+      if (branch) {
+        program.code[*branch].target = pc();
+      }
+    }
+    for (auto at : exits) {
+      program.code[at].target = pc();
+    }
+  }
+};
+
+} // namespace
+
+Program compile_module(const Module &module) {
+  Compiler c;
+  c.program.block_entry.reserve(module.blocks.size());
+  for (auto &block : module.blocks) {
+    // Empty blocks share their entry with whatever follows, which is how the
+    // cursor falls through to the next block.
+    c.program.block_entry.push_back(c.pc());
+    c.emit_block(block);
+  }
+  c.emit(Instruction{.op = Instruction::END});
+
+  for (auto entry : c.program.block_entry) {
+    c.program.code[entry].block_start = true;
+  }
+
+  // Now that every block has an entry, point moves straight at it.
+  for (auto &ins : c.program.code) {
+    if (ins.op == Instruction::MOVE) {
+      ins.target = ins.move->target_block >= 0
+                       ? c.program.block_entry[ins.move->target_block]
+                       : Instruction::NO_TARGET;
+    }
+  }
+
+  dbg_out(">>> compiled " << module.filename << ": " << c.program.code.size()
+                          << " instructions");
+  for (size_t i = 0; i < c.program.code.size(); i++) {
+    dbg_out("  " << i << ": " << c.program.code[i].dbg_desc());
+  }
+  return std::move(c.program);
+}
+
+Program compile_block(const Module &module, uint32_t index,
+                      const Block &block) {
+  Compiler c;
+  c.emit_block(block);
+
+  // Falls into the next block, as it would in the whole module. An empty
+  // block is only that, so entering it counts as entering the next one.
+  if (index + 1 < module.blocks.size()) {
+    c.emit(Instruction{.op = Instruction::ENTER, .target = index + 1});
+  } else {
+    c.emit(Instruction{.op = Instruction::END});
+  }
+  if (c.program.code.front().op != Instruction::ENTER) {
+    c.program.code.front().block_start = true;
+  }
+
+  // Moves go by block: the engine switches to the target's own segment
+  for (auto &ins : c.program.code) {
+    if (ins.op == Instruction::MOVE) {
+      ins.target = ins.move->target_block >= 0
+                       ? static_cast<uint32_t>(ins.move->target_block)
+                       : Instruction::NO_TARGET;
+    }
+  }
+
+  dbg_out(">>> compiled block " << block.tag << " of " << module.filename
+                                << ": " << c.program.code.size()
+                                << " instructions");
+  return std::move(c.program);
+}
+
+// SECTION: DEBUG
+
+std::string Instruction::dbg_desc() const {
+  switch (op) {
+  case BEAT:
+    return "BEAT " + beat->dbg_desc();
+  case MOVE:
+    return "MOVE " + move->target_tag + " @" + std::to_string(target);
+  case CALL:
+    return "CALL " + call->dbg_desc();
+  case MUTATE:
+    return "MUTATE " + mutation->dbg_desc();
+  case GO:
+    return "GO " + go->dbg_desc();
+  case EXIT:
+    return "EXIT " + exit->dbg_desc();
+  case CHOICES:
+    return "CHOICES x" + std::to_string(group->choices.size()) + " @" +
+           std::to_string(target);
+  case BRANCH:
+    return "BRANCH " + cond->dbg_desc() + " else " + std::to_string(target);
+  case JUMP:
+    return "JUMP " + std::to_string(target);
+  case ENTER:
+    return "ENTER " + std::to_string(target);
+  case END:
+    return "END";
+  }
+  return "!!INVALID!!";
+}
+
+} // namespace Skald
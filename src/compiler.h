@@ -0,0 +1,25 @@
+#pragma once
+#include "skald.h"
+#include <vector>
+
+namespace Skald {
+
+/** Resolves every Move's target tag to a block index. Returns an error for
+ *  each tag the module doesn't have. Run after parsing, before compiling. */
+std::vector<ParseError> link_module(Module &module);
+
+/** link_module for one block, against module's tags */
+std::vector<ParseError> link_block(const Module &module, Block &block);
+
+/** Lowers a parsed Module into its flat Program. The result points into the
+ *  module's blocks, so compile the module where it will live (it must not be
+ *  copied afterwards). */
+Program compile_module(const Module &module);
+
+/** Lowers one block of a lazily loaded module into a segment of its own:
+ *  the block's members, then an ENTER of the next block (or END). Its MOVEs
+ *  target block indices rather than pcs, and it has no block_entry. Same
+ *  lifetime rule as compile_module, for the block. */
+Program compile_block(const Module &module, uint32_t index, const Block &block);
+
+} // namespace Skald
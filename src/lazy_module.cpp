@@ -0,0 +1,183 @@
+#include "lazy_module.h"
+#include "compiler.h"
+#include "debug.h"
+#include "parse_state.h"
+#include "skald_actions.h"
+#include "skald_grammar.h"
+#include "tao/pegtl/parse.hpp"
+#include <tao/pegtl.hpp>
+
+namespace pegtl = tao::pegtl;
+
+namespace Skald {
+
+namespace {
+
+/** Parse state for block_index, which also notes where each body is */
+struct IndexState : ParseState {
+  IndexState(const std::string &filename, const Codex *c, const char *source)
+      : ParseState(filename, c), source(source) {}
+
+  const char *source;
+  std::vector<LazyBlocks::Body> bodies;
+};
+
+template <typename Rule> struct index_action : action<Rule> {};
+
+template <> struct index_action<block_tag_line> {
+  template <typename ActionInput>
+  static void apply(const ActionInput &input, IndexState &state) {
+    // A tag line that errs doesn't start a block (see skipped_block)
+    if (state.module.blocks.size() == state.bodies.size()) {
+      return;
+    }
+    size_t end = input.end() - state.source;
+    state.bodies.push_back(
+        LazyBlocks::Body{.begin = end,
+                         .end = end,
+                         .line = input.position().line + 1,
+                         .open_parent_tag = state.open_parent_tag,
+                         .open_child_tag = state.open_child_tag,
+                         .open_grandchild_tag = state.open_grandchild_tag});
+  }
+};
+
+template <> struct index_action<skipped_block> {
+  template <typename ActionInput>
+  static void apply(const ActionInput &input, IndexState &state) {
+    if (!state.bodies.empty()) {
+      state.bodies.back().end = input.end() - state.source;
+    }
+  }
+};
+
+} // namespace
+
+// SECTION: INDEXING
+
+std::optional<std::vector<ParseError>>
+index_module(std::string_view source, const std::string &file_path,
+             const Codex *codex, Module &module) {
+  pegtl::memory_input in(source.data(), source.size(), file_path);
+  IndexState pstate(module.filename, codex, source.data());
+  if (!pegtl::parse<block_index, index_action>(in, pstate)) {
+    dbg_out("Index failed!");
+    return std::nullopt;
+  }
+  dbg_out("Indexed " << pstate.bodies.size() << " blocks of " << file_path);
+
+  module = std::move(pstate.module);
+  for (auto &block : module.blocks) {
+    block.parsed = false;
+  }
+  module.lazy = std::make_shared<LazyBlocks>();
+  module.lazy->source = std::string(source);
+  module.lazy->file_path = file_path;
+  module.lazy->bodies = std::move(pstate.bodies);
+  module.lazy->parsed.resize(module.blocks.size());
+  module.lazy->local_vars = module.local_vars;
+  for (uint32_t i = 0; i < module.local_vars.size(); i++) {
+    module.lazy->local_slots.emplace(module.local_vars[i], i);
+  }
+  return std::move(pstate.errors);
+}
+
+// SECTION: PARSING BLOCKS
+
+/** Parses and compiles block into a ParsedBlock, or one holding why it
+ *  failed. Expects lazy.mutex held, as it adds to the local table. */
+static std::shared_ptr<const ParsedBlock>
+parse_lazy_block(const Module &module, LazyBlocks &lazy, uint32_t block) {
+  auto parsed = std::make_shared<ParsedBlock>();
+  parsed->index = block;
+  auto fail = [&](ParseResult result) {
+    parsed->result = std::move(result);
+    parsed->local_count = lazy.local_vars.size();
+    return parsed;
+  };
+
+  // Seed the parse state as a full parse would have it just past the tag
+  // line. New locals get slots after the ones already handed out.
+  auto &body = lazy.bodies[block];
+  ParseState pstate(module.filename, module.codex.get());
+  pstate.module.module_vars = module.module_vars;
+  pstate.module.local_vars = lazy.local_vars;
+  pstate.local_slots = lazy.local_slots;
+  pstate.open_parent_tag = body.open_parent_tag;
+  pstate.open_child_tag = body.open_child_tag;
+  pstate.open_grandchild_tag = body.open_grandchild_tag;
+  pstate.start_block(module.blocks[block].tag);
+
+  try {
+    const char *data = lazy.source.data();
+    pegtl::memory_input in(data + body.begin, data + body.end, lazy.file_path,
+                           body.begin, body.line, 1);
+    if (!pegtl::parse<lazy_block_body, action>(in, pstate)) {
+      return fail(
+          ParseResult::fail("Block parse failed: " + module.blocks[block].tag));
+    }
+  } catch (const pegtl::parse_error &e) {
+    dbg_out("Parse error: " << e.what());
+    return fail(ParseResult::fail(e.what()));
+  }
+
+  Block &block_ast = pstate.module.blocks.front();
+  auto link_errors = link_block(module, block_ast);
+  pstate.errors.insert(pstate.errors.end(), link_errors.begin(),
+                       link_errors.end());
+  auto result = ParseResult::with(pstate.errors);
+  if (!result.ok) {
+    return fail(std::move(result));
+  }
+
+  // Only a block that parsed cleanly adds its locals to the table
+  for (size_t i = lazy.local_vars.size(); i < pstate.module.local_vars.size();
+       i++) {
+    lazy.local_slots.emplace(pstate.module.local_vars[i], i);
+    lazy.local_vars.push_back(std::move(pstate.module.local_vars[i]));
+  }
+  parsed->block = std::move(block_ast);
+  parsed->program = compile_block(module, block, parsed->block);
+  parsed->result = std::move(result);
+  parsed->local_count = lazy.local_vars.size();
+  return parsed;
+}
+
+std::shared_ptr<const ParsedBlock> lazy_block(const Module &module,
+                                              uint32_t block,
+                                              bool *parsed_now) {
+  LazyBlocks &lazy = *module.lazy;
+  if (parsed_now)
+    *parsed_now = false;
+  if (auto parsed = std::atomic_load(&lazy.parsed[block])) {
+    return parsed;
+  }
+
+  // Parsed under the lock: blocks share the local table, and a block one
+  // engine is already parsing is the one another will want next
+  std::lock_guard<std::mutex> lock(lazy.mutex);
+  if (auto parsed = std::atomic_load(&lazy.parsed[block])) {
+    return parsed;
+  }
+  auto parsed = parse_lazy_block(module, lazy, block);
+  std::atomic_store(&lazy.parsed[block], parsed);
+  if (parsed_now)
+    *parsed_now = true;
+  return parsed;
+}
+
+std::vector<std::string> lazy_local_vars(LazyBlocks &lazy) {
+  std::lock_guard<std::mutex> lock(lazy.mutex);
+  return lazy.local_vars;
+}
+
+uint32_t lazy_local_slot(LazyBlocks &lazy, const std::string &name) {
+  std::lock_guard<std::mutex> lock(lazy.mutex);
+  auto [it, added] =
+      lazy.local_slots.emplace(name, uint32_t(lazy.local_vars.size()));
+  if (added)
+    lazy.local_vars.push_back(name);
+  return it->second;
+}
+
+} // namespace Skald
@@ -0,0 +1,93 @@
+#pragma once
+#include "skald.h"
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace Skald {
+
+/** One block of a lazily loaded module, parsed. Its segment is the block
+ *  compiled on its own (see compile_block); the engine runs it in place of
+ *  the module's Program. Never changes once made, so it's shared by every
+ *  engine running the module. */
+struct ParsedBlock {
+  uint32_t index = 0;
+  Block block;
+  Program program;
+
+  /** The parse's warnings or errors; if it failed, block and program are
+   *  empty. Kept, so a block with errors reports them each time it's
+   *  entered without being parsed again. */
+  ParseResult result;
+
+  /** Size of the local table once this block was parsed; its locals all
+   *  have slots below this. */
+  size_t local_count = 0;
+};
+
+struct LazyBlocks {
+  /** A copy of the module source. The reader's bytes may map a file, which
+   *  an editor could rewrite (or truncate) under a running session. */
+  std::string source;
+
+  /** Resolved path, for positions in errors */
+  std::string file_path;
+
+  /** Where a block's body is, and the tags open just past its tag line,
+   *  which relative moves in it resolve against */
+  struct Body {
+    size_t begin = 0;
+    size_t end = 0;
+    size_t line = 0;
+    std::string open_parent_tag;
+    std::string open_child_tag;
+    std::string open_grandchild_tag;
+  };
+
+  /** Indexed like Module::blocks */
+  std::vector<Body> bodies;
+
+  /** Indexed like Module::blocks; null until some engine first enters the
+   *  block. Each is set once, under mutex, and read with std::atomic_load,
+   *  so entering a block that's already parsed never takes the lock. */
+  std::vector<std::shared_ptr<const ParsedBlock>> parsed;
+
+  /** Every local the parsed blocks use, by slot; starts out as the module's
+   *  own local_vars. Slots are handed out in the order blocks get parsed,
+   *  which differs between processes, so snapshots save locals by name.
+   *  Guarded by mutex. */
+  std::vector<std::string> local_vars;
+  std::unordered_map<std::string, uint32_t> local_slots;
+
+  std::mutex mutex;
+};
+
+/** load_module's lazy_blocks mode: parses the top matter and indexes blocks
+ *  by their tag lines into module (whose filename should already be set),
+ *  leaving every block unparsed. Returns the parse's errors, or nullopt if
+ *  the source doesn't parse at all. A lazy module has no Program of its
+ *  own: the engine runs each block's segment (see lazy_block). */
+std::optional<std::vector<ParseError>>
+index_module(std::string_view source, const std::string &file_path,
+             const Codex *codex, Module &module);
+
+/** Block of a lazily loaded module, parsing it first if no engine has yet.
+ *  Never null; check its result. parsed_now is set if this call did the
+ *  parse. */
+std::shared_ptr<const ParsedBlock> lazy_block(const Module &module,
+                                              uint32_t block,
+                                              bool *parsed_now = nullptr);
+
+/** A copy of the module's local table, by slot */
+std::vector<std::string> lazy_local_vars(LazyBlocks &lazy);
+
+/** The slot of a local in the module's table, adding it if no block parsed
+ *  so far uses it */
+uint32_t lazy_local_slot(LazyBlocks &lazy, const std::string &name);
+
+} // namespace Skald
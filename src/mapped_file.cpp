@@ -0,0 +1,69 @@
+#include "mapped_file.h"
+#include <fstream>
+#include <iterator>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SKALD_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <filesystem>
+#endif
+
+namespace Skald {
+
+std::shared_ptr<const MappedFile> MappedFile::open(const std::string &path,
+                                                   std::string *why) {
+  auto file = std::make_shared<MappedFile>();
+  auto fail = [&](const char *msg) {
+    if (why)
+      *why = msg;
+    return nullptr;
+  };
+#ifdef SKALD_MMAP
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return fail("couldn't open it.");
+  struct stat st;
+  if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    ::close(fd);
+    return fail("couldn't open it.");
+  }
+  if (st.st_size == 0) {
+    // Nothing to map; an empty file is still a file
+    ::close(fd);
+    return file;
+  }
+  void *addr = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (addr != MAP_FAILED) {
+    file->data_ = static_cast<const uint8_t *>(addr);
+    file->size_ = st.st_size;
+    file->mapped_ = true;
+    return file;
+  }
+#else
+  std::error_code ec;
+  if (!std::filesystem::is_regular_file(path, ec))
+    return fail("couldn't open it.");
+#endif
+  // No mmap here (or it failed): read it all in with one open
+  std::ifstream f(path, std::ios::binary);
+  if (!f)
+    return fail("couldn't open it.");
+  file->buffer_.assign(std::istreambuf_iterator<char>(f), {});
+  file->data_ = reinterpret_cast<const uint8_t *>(file->buffer_.data());
+  file->size_ = file->buffer_.size();
+  return file;
+}
+
+MappedFile::~MappedFile() {
+#ifdef SKALD_MMAP
+  if (mapped_)
+    ::munmap(const_cast<uint8_t *>(data_), size_);
+#endif
+}
+
+} // namespace Skald
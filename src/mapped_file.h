@@ -0,0 +1,38 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace Skald {
+
+/** A whole file, read-only: mapped where the platform can, read in once
+ *  otherwise. Unmapped when the last reference goes. */
+class MappedFile {
+public:
+  /** Opens path; returns null (and why, if asked) if it isn't a readable
+   *  regular file */
+  static std::shared_ptr<const MappedFile> open(const std::string &path,
+                                                std::string *why = nullptr);
+
+  MappedFile() = default;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  ~MappedFile();
+
+  const uint8_t *data() const { return data_; }
+  size_t size() const { return size_; }
+  std::string_view view() const {
+    return {reinterpret_cast<const char *>(data_), size_};
+  }
+
+private:
+  const uint8_t *data_ = nullptr;
+  size_t size_ = 0;
+  bool mapped_ = false;
+  std::string buffer_;
+};
+
+} // namespace Skald
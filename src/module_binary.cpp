@@ -0,0 +1,682 @@
+#include "module_binary.h"
+#include "binary_io.h"
+#include "debug.h"
+#include "lazy_module.h"
+#include "skald.h"
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+namespace Skald {
+
+// SECTION: ENCODING
+
+/** Bumped whenever the layout below changes; older files must be compiled
+ *  again.
+ *
+ *  Module layout (encodings as in binary_io.h; line numbers are u32, enums
+ *  u8, optionals a u8 flag then the value if set, lists a u32 count):
+ *   - "SKBC", u16 version
+ *   - u64 hash of the source it was compiled from, u64 codex fingerprint
+ *   - module vars (line, value, variable each), local var names
+ *   - testbeds: line, name, then (line, variable name, value) each
+ *   - blocks: line, tag, then members, each either a block member (u8 0) or
+ *     a conditional chain (u8 1) of (line, condition, block members) blocks
+ *  Block members are a member (u8 0) or a choice group (u8 1): line, then
+ *  choices of line, condition, text and members. Members are line, body
+ *  (u8 MemberBody index, then its fields) and condition. Rvalues are a
+ *  value, or u8 4 and a variable (name, type, scope, u32 slot), or u8 5 and
+ *  a call (line, method, args, i32 method index). Conditionals are line,
+ *  type, then items: u8 0 and an atom (a, comparison, optional b), or u8 1
+ *  and a nested conditional.
+ *
+ *  Codex layout: "SKBX", u16 version, globals as module vars are, then
+ *  method defs (line, name, return type, args of name and type, u8 cache
+ *  policy + 1 or 0). A module's codex fingerprint is the FNV-1a of what it
+ *  depends on in the codex: global names and types in slot order, then
+ *  method names, return types and argument types in index order (see
+ *  codex_fingerprint). */
+static constexpr uint16_t COMPILED_VERSION = 2;
+static constexpr char MODULE_MAGIC[4] = {'S', 'K', 'B', 'C'};
+static constexpr char CODEX_MAGIC[4] = {'S', 'K', 'B', 'X'};
+
+static constexpr uint8_t RVAL_VARIABLE = 4;
+static constexpr uint8_t RVAL_CALL = 5;
+
+/** How deep conditionals and method call arguments may nest; deeper is
+ *  treated as damage rather than risking the stack. */
+static constexpr int MAX_DEPTH = 64;
+
+namespace {
+
+void write_variable(Writer &w, const Variable &var) {
+  w.str(var.name);
+  w.num<uint8_t>(var.type);
+  w.num<uint8_t>(static_cast<uint8_t>(var.scope));
+  w.num<uint32_t>(var.slot);
+}
+
+void write_declared(Writer &w, const DeclaredVar &dec) {
+  w.num<uint32_t>(dec.line_number);
+  w.value(dec.initial_value);
+  write_variable(w, dec.var);
+}
+
+void write_rvalue(Writer &w, const RValue &rval);
+
+void write_call(Writer &w, const MethodCall &call) {
+  w.num<uint32_t>(call.line_number);
+  w.str(call.method);
+  w.num<uint32_t>(call.args.size());
+  for (auto &arg : call.args) {
+    write_rvalue(w, arg);
+  }
+  w.num<int32_t>(call.method_index);
+}
+
+void write_rvalue(Writer &w, const RValue &rval) {
+  if (auto simple = cast_rval_to_simple(rval)) {
+    w.value(*simple);
+  } else if (auto *var = rval_get_var(rval)) {
+    w.num<uint8_t>(RVAL_VARIABLE);
+    write_variable(w, *var);
+  } else {
+    w.num<uint8_t>(RVAL_CALL);
+    write_call(w, *rval_get_call(rval));
+  }
+}
+
+void write_optional_rvalue(Writer &w, const std::optional<RValue> &rval) {
+  w.num<uint8_t>(rval.has_value());
+  if (rval)
+    write_rvalue(w, *rval);
+}
+
+void write_conditional(Writer &w, const Conditional &cond) {
+  w.num<uint32_t>(cond.line_number);
+  w.num<uint8_t>(cond.type);
+  w.num<uint32_t>(cond.items.size());
+  for (auto &item : cond.items) {
+    if (auto *atom = std::get_if<ConditionalAtom>(&item)) {
+      w.num<uint8_t>(0);
+      write_rvalue(w, atom->a);
+      w.num<uint8_t>(atom->comparison);
+      write_optional_rvalue(w, atom->b);
+    } else {
+      w.num<uint8_t>(1);
+      write_conditional(w, *std::get<std::shared_ptr<Conditional>>(item));
+    }
+  }
+}
+
+void write_attached(Writer &w, const AttachedCondition &ac) {
+  w.num<uint8_t>(ac.condition.has_value());
+  if (ac.condition)
+    write_conditional(w, *ac.condition);
+}
+
+void write_text(Writer &w, const TextContent &text) {
+  w.num<uint32_t>(text.parts.size());
+  for (auto &part : text.parts) {
+    w.num<uint8_t>(part.index());
+    if (auto *str = std::get_if<std::string>(&part)) {
+      w.str(*str);
+    } else if (auto *simple = std::get_if<SimpleInsertion>(&part)) {
+      write_rvalue(w, simple->rvalue);
+    } else {
+      auto &tern = std::get<TernaryInsertion>(part);
+      write_rvalue(w, tern.check);
+      w.num<uint8_t>(tern.check_truthy);
+      w.num<uint32_t>(tern.options.size());
+      for (auto &[key, val] : tern.options) {
+        write_rvalue(w, key);
+        write_rvalue(w, val);
+      }
+    }
+  }
+}
+
+void write_member(Writer &w, const Member &mem) {
+  w.num<uint32_t>(mem.line_number);
+  w.num<uint8_t>(mem.body.index());
+  std::visit(
+      [&](const auto &body) {
+        using T = std::decay_t<decltype(body)>;
+        if constexpr (std::is_same_v<T, MethodCall>) {
+          write_call(w, body);
+          return;
+        } else {
+          w.num<uint32_t>(body.line_number);
+        }
+        if constexpr (std::is_same_v<T, Move>) {
+          w.str(body.target_tag);
+          w.num<int32_t>(body.target_block);
+        } else if constexpr (std::is_same_v<T, Mutation>) {
+          write_variable(w, body.lvalue);
+          w.num<uint8_t>(body.type);
+          write_optional_rvalue(w, body.rvalue);
+        } else if constexpr (std::is_same_v<T, GoModule>) {
+          w.str(body.module_path);
+          w.str(body.start_in_tag);
+        } else if constexpr (std::is_same_v<T, Exit>) {
+          write_optional_rvalue(w, body.argument);
+        } else if constexpr (std::is_same_v<T, Beat>) {
+          w.str(body.attribution);
+          write_text(w, body.content);
+        }
+      },
+      mem.body);
+  write_attached(w, mem.ac);
+}
+
+void write_block_member(Writer &w, const BlockMember &bm) {
+  if (auto *mem = std::get_if<Member>(&bm)) {
+    w.num<uint8_t>(0);
+    write_member(w, *mem);
+    return;
+  }
+  auto &group = std::get<ChoiceGroup>(bm);
+  w.num<uint8_t>(1);
+  w.num<uint32_t>(group.line_number);
+  w.num<uint32_t>(group.choices.size());
+  for (auto &choice : group.choices) {
+    w.num<uint32_t>(choice.line_number);
+    write_attached(w, choice.condition);
+    write_text(w, choice.content);
+    w.num<uint32_t>(choice.members.size());
+    for (auto &mem : choice.members) {
+      write_member(w, mem);
+    }
+  }
+}
+
+/** members are block's, or for a lazily loaded module its parsed body's */
+void write_block(Writer &w, const Block &block,
+                 const std::vector<MainBlockMember> &members) {
+  w.num<uint32_t>(block.line_number);
+  w.str(block.tag);
+  w.num<uint32_t>(members.size());
+  for (auto &mbm : members) {
+    if (auto *bm = std::get_if<BlockMember>(&mbm)) {
+      w.num<uint8_t>(0);
+      write_block_member(w, *bm);
+      continue;
+    }
+    auto &chain = std::get<ConditionalChain>(mbm);
+    w.num<uint8_t>(1);
+    w.num<uint32_t>(chain.cond_blocks.size());
+    for (auto &cb : chain.cond_blocks) {
+      w.num<uint32_t>(cb.line_number);
+      write_attached(w, cb.cond);
+      w.num<uint32_t>(cb.members.size());
+      for (auto &bm : cb.members) {
+        write_block_member(w, bm);
+      }
+    }
+  }
+}
+
+/** Globals and method defs: the codex body */
+void write_codex_body(Writer &w, const Codex &codex) {
+  w.num<uint32_t>(codex.global_vars.size());
+  for (auto &dec : codex.global_vars) {
+    write_declared(w, dec);
+  }
+  w.num<uint32_t>(codex.method_defs.size());
+  for (auto &def : codex.method_defs) {
+    w.num<uint32_t>(def.line_number);
+    w.str(def.name);
+    w.num<uint8_t>(def.return_type);
+    w.num<uint32_t>(def.args.size());
+    for (auto &arg : def.args) {
+      w.str(arg.name);
+      w.num<uint8_t>(arg.type);
+    }
+    w.num<uint8_t>(
+        def.cache_policy ? static_cast<uint8_t>(*def.cache_policy) + 1 : 0);
+  }
+}
+
+/** Only what gives a module's slots and method indices their meaning, so a
+ *  module loads against any codex that agrees on them. Line numbers,
+ *  initial values, argument names and cache policies are left out: editing
+ *  those (or a comment) doesn't make every module compile again. */
+uint64_t codex_fingerprint(const Codex *codex) {
+  if (!codex)
+    return 0;
+  Writer w;
+  w.num<uint32_t>(codex->global_vars.size());
+  for (auto &dec : codex->global_vars) {
+    w.str(dec.var.name);
+    w.num<uint8_t>(dec.var.type);
+  }
+  w.num<uint32_t>(codex->method_defs.size());
+  for (auto &def : codex->method_defs) {
+    w.str(def.name);
+    w.num<uint8_t>(def.return_type);
+    w.num<uint32_t>(def.args.size());
+    for (auto &arg : def.args) {
+      w.num<uint8_t>(arg.type);
+    }
+  }
+  return fnv1a(w.out.data(), w.out.size());
+}
+
+// SECTION: DECODING
+
+/** Reads a module back. Every enum and index is checked as it's read, since
+ *  the compiler and engine trust them; anything out of range fails the read
+ *  like a truncated file does. */
+struct Decoder {
+  Reader &r;
+  const Codex *codex;
+  size_t module_vars = 0;
+  size_t local_vars = 0;
+  size_t blocks = 0;
+  int depth = 0;
+
+  /** Fails the read unless cond holds; returns cond */
+  bool check(bool cond) {
+    if (!cond)
+      r.ok = false;
+    return cond;
+  }
+
+  template <typename E> E enum_up_to(E last) {
+    auto val = r.num<uint8_t>();
+    return check(val <= static_cast<uint8_t>(last)) ? static_cast<E>(val)
+                                                    : E{};
+  }
+
+  size_t line() { return r.num<uint32_t>(); }
+
+  /** A variable use; its slot must be in range. Declarations aren't
+   *  resolved, so their scope and slot are left as read. */
+  Variable variable(bool resolved = true) {
+    Variable var;
+    var.name = r.str();
+    var.type = enum_up_to(ACTION);
+    var.scope = enum_up_to(VarScope::LOCAL);
+    var.slot = r.num<uint32_t>();
+    if (!resolved)
+      return var;
+    switch (var.scope) {
+    case VarScope::GLOBAL:
+      check(codex && var.slot < codex->global_vars.size());
+      break;
+    case VarScope::MODULE:
+      check(var.slot < module_vars);
+      break;
+    case VarScope::LOCAL:
+      check(var.slot < local_vars);
+      break;
+    }
+    return var;
+  }
+
+  DeclaredVar declared() {
+    DeclaredVar dec;
+    dec.line_number = line();
+    dec.initial_value = r.value();
+    dec.var = variable(false);
+    return dec;
+  }
+
+  MethodCall call() {
+    MethodCall call;
+    if (!check(++depth <= MAX_DEPTH))
+      return call;
+    call.line_number = line();
+    call.method = r.str();
+    call.args.resize(r.count(1));
+    for (auto &arg : call.args) {
+      arg = rvalue();
+    }
+    call.method_index = r.num<int32_t>();
+    check(call.method_index < 0 ||
+          (codex && size_t(call.method_index) < codex->method_defs.size()));
+    call.key = key_for_call(call);
+    depth--;
+    return call;
+  }
+
+  RValue rvalue() {
+    switch (r.peek()) {
+    case RVAL_VARIABLE:
+      r.pos++;
+      return variable();
+    case RVAL_CALL:
+      r.pos++;
+      return std::make_shared<MethodCall>(call());
+    default:
+      return std::visit([](auto &&v) -> RValue { return std::move(v); },
+                        r.value());
+    }
+  }
+
+  std::optional<RValue> optional_rvalue() {
+    if (!r.num<uint8_t>())
+      return std::nullopt;
+    return rvalue();
+  }
+
+  Conditional conditional() {
+    Conditional cond;
+    if (!check(++depth <= MAX_DEPTH))
+      return cond;
+    cond.line_number = line();
+    cond.type = enum_up_to(Conditional::OR);
+    size_t n = r.count(1);
+    cond.items.reserve(n);
+    for (size_t i = n; i > 0 && r.ok; i--) {
+      if (r.num<uint8_t>() == 0) {
+        ConditionalAtom atom;
+        atom.a = rvalue();
+        atom.comparison = enum_up_to(ConditionalAtom::LESS_EQUAL);
+        atom.b = optional_rvalue();
+        cond.items.push_back(std::move(atom));
+      } else {
+        cond.items.push_back(std::make_shared<Conditional>(conditional()));
+      }
+    }
+    depth--;
+    return cond;
+  }
+
+  AttachedCondition attached() {
+    AttachedCondition ac;
+    if (r.num<uint8_t>())
+      ac.condition = conditional();
+    return ac;
+  }
+
+  TextContent text() {
+    TextContent text;
+    text.parts.resize(r.count(1));
+    for (auto &part : text.parts) {
+      switch (r.num<uint8_t>()) {
+      case 0:
+        part = r.str();
+        break;
+      case 1:
+        part = SimpleInsertion{.rvalue = rvalue()};
+        break;
+      case 2: {
+        TernaryInsertion tern{.check = rvalue()};
+        tern.check_truthy = r.num<uint8_t>() != 0;
+        tern.options.resize(r.count(2));
+        for (auto &[key, val] : tern.options) {
+          key = rvalue();
+          val = rvalue();
+        }
+        part = std::move(tern);
+      } break;
+      default:
+        check(false);
+      }
+    }
+    return text;
+  }
+
+  Member member() {
+    Member mem;
+    mem.line_number = line();
+    switch (r.num<uint8_t>()) {
+    case 0: {
+      Move move;
+      move.line_number = line();
+      move.target_tag = r.str();
+      move.target_block = r.num<int32_t>();
+      check(move.target_block < 0 || size_t(move.target_block) < blocks);
+      mem.body = std::move(move);
+    } break;
+    case 1:
+      mem.body = call();
+      break;
+    case 2: {
+      Mutation mut;
+      mut.line_number = line();
+      mut.lvalue = variable();
+      mut.type = enum_up_to(Mutation::SUBTRACT);
+      mut.rvalue = optional_rvalue();
+      mem.body = std::move(mut);
+    } break;
+    case 3: {
+      GoModule go;
+      go.line_number = line();
+      go.module_path = r.str();
+      go.start_in_tag = r.str();
+      mem.body = std::move(go);
+    } break;
+    case 4: {
+      Exit exit;
+      exit.line_number = line();
+      exit.argument = optional_rvalue();
+      mem.body = std::move(exit);
+    } break;
+    case 5: {
+      Beat beat;
+      beat.line_number = line();
+      beat.attribution = r.str();
+      beat.content = text();
+      mem.body = std::move(beat);
+    } break;
+    default:
+      check(false);
+    }
+    mem.ac = attached();
+    return mem;
+  }
+
+  BlockMember block_member() {
+    if (r.num<uint8_t>() == 0)
+      return member();
+    ChoiceGroup group;
+    group.line_number = line();
+    group.choices.resize(r.count(1));
+    for (auto &choice : group.choices) {
+      choice.line_number = line();
+      choice.condition = attached();
+      choice.content = text();
+      size_t n = r.count(1);
+      choice.members.reserve(n);
+      for (size_t i = n; i > 0 && r.ok; i--) {
+        choice.members.push_back(member());
+      }
+    }
+    return group;
+  }
+
+  void block(Block &block) {
+    block.line_number = line();
+    block.tag = r.str();
+    size_t n = r.count(1);
+    block.members.reserve(n);
+    for (size_t i = n; i > 0 && r.ok; i--) {
+      if (r.num<uint8_t>() == 0) {
+        block.members.push_back(block_member());
+        continue;
+      }
+      ConditionalChain chain;
+      chain.cond_blocks.resize(r.count(1));
+      for (auto &cb : chain.cond_blocks) {
+        cb.line_number = line();
+        cb.cond = attached();
+        size_t m = r.count(1);
+        cb.members.reserve(m);
+        for (size_t j = m; j > 0 && r.ok; j--) {
+          cb.members.push_back(block_member());
+        }
+      }
+      block.members.push_back(std::move(chain));
+    }
+  }
+};
+
+} // namespace
+
+bool is_compiled_module(std::string_view bytes) {
+  return has_magic(bytes, MODULE_MAGIC);
+}
+
+bool is_compiled_codex(std::string_view bytes) {
+  return has_magic(bytes, CODEX_MAGIC);
+}
+
+std::string save_compiled(const Module &module, std::string *why) {
+  // A lazily loaded module's blocks are only their tag lines until parsed,
+  // so parse the rest first. Its locals are in the table they share.
+  std::vector<std::shared_ptr<const ParsedBlock>> parsed;
+  std::vector<std::string> lazy_locals;
+  if (module.lazy) {
+    for (uint32_t i = 0; i < module.blocks.size(); i++) {
+      parsed.push_back(lazy_block(module, i));
+      if (!parsed.back()->result.ok) {
+        if (why)
+          *why = "block " + module.blocks[i].tag + " didn't parse.";
+        return "";
+      }
+    }
+    lazy_locals = lazy_local_vars(*module.lazy);
+  }
+  auto &local_vars = module.lazy ? lazy_locals : module.local_vars;
+
+  Writer w;
+  w.out.insert(w.out.end(), MODULE_MAGIC, MODULE_MAGIC + 4);
+  w.num<uint16_t>(COMPILED_VERSION);
+  w.num<uint64_t>(module.source_hash);
+  w.num<uint64_t>(codex_fingerprint(module.codex.get()));
+
+  w.num<uint32_t>(module.module_vars.size());
+  for (auto &dec : module.module_vars) {
+    write_declared(w, dec);
+  }
+  w.num<uint32_t>(local_vars.size());
+  for (auto &name : local_vars) {
+    w.str(name);
+  }
+  w.num<uint32_t>(module.testbeds.size());
+  for (auto &testbed : module.testbeds) {
+    w.num<uint32_t>(testbed.line_number);
+    w.str(testbed.name);
+    w.num<uint32_t>(testbed.declarations.size());
+    for (auto &dec : testbed.declarations) {
+      w.num<uint32_t>(dec.line_number);
+      w.str(dec.variable);
+      w.value(dec.test_value);
+    }
+  }
+  w.num<uint32_t>(module.blocks.size());
+  for (size_t i = 0; i < module.blocks.size(); i++) {
+    auto &block = module.blocks[i];
+    write_block(w, block,
+                parsed.empty() ? block.members : parsed[i]->block.members);
+  }
+  return std::string(w.out.begin(), w.out.end());
+}
+
+std::string save_compiled(const Codex &codex) {
+  Writer w;
+  w.out.insert(w.out.end(), CODEX_MAGIC, CODEX_MAGIC + 4);
+  w.num<uint16_t>(COMPILED_VERSION);
+  write_codex_body(w, codex);
+  return std::string(w.out.begin(), w.out.end());
+}
+
+std::optional<std::string> decode_module(std::string_view bytes,
+                                         Module &module, const Codex *codex) {
+  Reader r(bytes);
+  if (auto why = read_header(r, MODULE_MAGIC, COMPILED_VERSION, "module")) {
+    return *why;
+  }
+  module.source_hash = r.num<uint64_t>();
+  if (r.ok && r.num<uint64_t>() != codex_fingerprint(codex)) {
+    return "it was compiled against a different codex; compile it again.";
+  }
+
+  Decoder d{.r = r, .codex = codex};
+  module.module_vars.resize(r.count(1));
+  d.module_vars = module.module_vars.size();
+  for (auto &dec : module.module_vars) {
+    dec = d.declared();
+  }
+  module.local_vars.resize(r.count(4));
+  d.local_vars = module.local_vars.size();
+  for (auto &name : module.local_vars) {
+    name = r.str();
+  }
+
+  module.testbeds.resize(r.count(1));
+  for (auto &testbed : module.testbeds) {
+    testbed.line_number = d.line();
+    testbed.name = r.str();
+    testbed.declarations.resize(r.count(1));
+    for (auto &dec : testbed.declarations) {
+      dec.line_number = d.line();
+      dec.variable = r.str();
+      dec.test_value = r.value();
+    }
+  }
+
+  module.blocks.resize(r.count(1));
+  d.blocks = module.blocks.size();
+  for (size_t i = 0; i < module.blocks.size() && r.ok; i++) {
+    d.block(module.blocks[i]);
+    module.block_lookup[module.blocks[i].tag] = i;
+  }
+
+  if (!r.ok || r.pos != r.size) {
+    return std::string("it's damaged.");
+  }
+  return std::nullopt;
+}
+
+bool compiled_is_current(std::string_view compiled, uint64_t source_hash,
+                         const Codex *codex) {
+  Reader r(compiled);
+  if (read_header(r, MODULE_MAGIC, COMPILED_VERSION, "module")) {
+    return false;
+  }
+  bool current = r.num<uint64_t>() == source_hash &&
+                 r.num<uint64_t>() == codex_fingerprint(codex);
+  return r.ok && current;
+}
+
+std::optional<std::string> decode_codex(std::string_view bytes,
+                                        Codex &codex) {
+  Reader r(bytes);
+  if (auto why = read_header(r, CODEX_MAGIC, COMPILED_VERSION, "codex")) {
+    return *why;
+  }
+  Decoder d{.r = r, .codex = &codex};
+  codex.global_vars.resize(r.count(1));
+  for (uint32_t slot = 0; slot < codex.global_vars.size(); slot++) {
+    auto &dec = codex.global_vars[slot];
+    dec = d.declared();
+    d.check(dec.var.scope == VarScope::GLOBAL && dec.var.slot == slot);
+    codex.global_slots[dec.var.name] = slot;
+  }
+  codex.method_defs.resize(r.count(1));
+  for (auto &def : codex.method_defs) {
+    def.line_number = d.line();
+    def.name = r.str();
+    def.return_type = d.enum_up_to(ACTION);
+    def.args.resize(r.count(5));
+    for (auto &arg : def.args) {
+      arg.name = r.str();
+      arg.type = d.enum_up_to(ACTION);
+    }
+    auto policy = r.num<uint8_t>();
+    if (policy > 0 &&
+        d.check(policy - 1 <= static_cast<uint8_t>(CachePolicy::PURE))) {
+      def.cache_policy = static_cast<CachePolicy>(policy - 1);
+    }
+  }
+  if (!r.ok || r.pos != r.size) {
+    return std::string("it's damaged.");
+  }
+  return std::nullopt;
+}
+
+} // namespace Skald
@@ -0,0 +1,33 @@
+#pragma once
+#include "skald.h"
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace Skald {
+
+/** True if bytes are a compiled module or codex (see save_compiled) rather
+ *  than source text. */
+bool is_compiled_module(std::string_view bytes);
+bool is_compiled_codex(std::string_view bytes);
+
+/** Decodes a compiled module into module, whose filename should already be
+ *  set. Everything the parser and linker would produce is filled in,
+ *  source_hash included; the caller still compiles it. Returns why not if
+ *  the bytes are damaged, from another format version, or were compiled
+ *  against a codex that doesn't match this one. */
+std::optional<std::string> decode_module(std::string_view bytes,
+                                         Module &module, const Codex *codex);
+
+/** True if compiled is a module in this format version, compiled from
+ *  source with this hash (see fnv1a) against codex; compiling again would
+ *  give the same bytes. */
+bool compiled_is_current(std::string_view compiled, uint64_t source_hash,
+                         const Codex *codex);
+
+/** Decodes a compiled codex into codex, whose path and filename should
+ *  already be set. */
+std::optional<std::string> decode_codex(std::string_view bytes,
+                                        Codex &codex);
+
+} // namespace Skald
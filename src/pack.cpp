@@ -0,0 +1,123 @@
+#include "binary_io.h"
+#include "debug.h"
+#include "mapped_file.h"
+#include "skald.h"
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace Skald {
+
+/** Bumped whenever the layout below changes; older packs must be built
+ *  again.
+ *
+ *  Layout (encodings as in binary_io.h):
+ *   - "SKPK", u16 version
+ *   - u32 file count, then per file: path, u64 offset, u64 size
+ *   - the files' bytes, back to back; offsets count from the start of the
+ *     pack */
+static constexpr uint16_t PACK_VERSION = 1;
+static constexpr char PACK_MAGIC[4] = {'S', 'K', 'P', 'K'};
+
+/** How paths are compared, so "./a/../b.ska" finds "b.ska" */
+static std::string pack_key(const std::string &path) {
+  return std::filesystem::path(path).lexically_normal().generic_string();
+}
+
+std::string save_pack(
+    const std::vector<std::pair<std::string, std::string>> &files) {
+  size_t offset = sizeof(PACK_MAGIC) + sizeof(uint16_t) + sizeof(uint32_t);
+  for (auto &[path, bytes] : files) {
+    offset += sizeof(uint32_t) + pack_key(path).size() + 2 * sizeof(uint64_t);
+  }
+
+  Writer w;
+  w.out.insert(w.out.end(), PACK_MAGIC, PACK_MAGIC + 4);
+  w.num<uint16_t>(PACK_VERSION);
+  w.num<uint32_t>(files.size());
+  for (auto &[path, bytes] : files) {
+    w.str(pack_key(path));
+    w.num<uint64_t>(offset);
+    w.num<uint64_t>(bytes.size());
+    offset += bytes.size();
+  }
+  for (auto &[path, bytes] : files) {
+    w.out.insert(w.out.end(), bytes.begin(), bytes.end());
+  }
+  return std::string(w.out.begin(), w.out.end());
+}
+
+namespace {
+
+/** An open pack: the mapped file and the index into it. Read-only once
+ *  opened. */
+class PackFile {
+public:
+  /** Reads the index, checking every entry lies inside the file */
+  std::optional<std::string> open(const std::string &path) {
+    std::string err;
+    file = MappedFile::open(path, &err);
+    if (!file) {
+      return err;
+    }
+    Reader r(file->data(), file->size());
+    if (auto why = read_header(r, PACK_MAGIC, PACK_VERSION, "pack")) {
+      return why;
+    }
+    auto count = r.count(sizeof(uint32_t) + 2 * sizeof(uint64_t));
+    index.reserve(count);
+    for (uint32_t i = 0; i < count && r.ok; i++) {
+      auto path = r.str();
+      auto offset = r.num<uint64_t>();
+      auto length = r.num<uint64_t>();
+      if (offset > file->size() || length > file->size() - offset) {
+        r.ok = false;
+        break;
+      }
+      index[std::move(path)] = {offset, length};
+    }
+    if (!r.ok) {
+      return std::string("it's damaged.");
+    }
+    return std::nullopt;
+  }
+
+  std::optional<std::string_view> find(const std::string &path) const {
+    auto it = index.find(pack_key(path));
+    if (it == index.end())
+      return std::nullopt;
+    auto [offset, length] = it->second;
+    return file->view().substr(offset, length);
+  }
+
+private:
+  std::shared_ptr<const MappedFile> file;
+  std::unordered_map<std::string, std::pair<uint64_t, uint64_t>> index;
+};
+
+} // namespace
+
+std::optional<SourceViewReader>
+pack_source_reader(const std::string &pack_path, std::string *why) {
+  auto pack = std::make_shared<PackFile>();
+  if (auto err = pack->open(pack_path)) {
+    dbg_out("Couldn't load pack " << pack_path << ": " << *err);
+    if (why)
+      *why = "Couldn't load pack " + pack_path + ": " + *err;
+    return std::nullopt;
+  }
+  // Lent straight out of the mapping, which the pack keeps alive
+  return SourceViewReader(
+      [pack](const std::string &path) -> std::optional<SourceView> {
+        auto bytes = pack->find(path);
+        if (!bytes)
+          return std::nullopt;
+        return SourceView{.bytes = *bytes, .owner = pack};
+      });
+}
+
+} // namespace Skald
@@ -13,6 +13,33 @@ ParseState::ParseState(const std::string &filename, const Codex *c) {
 
 // SECTION: MODULE LEVEL
 
+// SECTION: DECLARATIONS AND MODULE VARS
+
+Variable ParseState::resolve_var(const std::string &name) {
+  if (codex) {
+    int slot = codex->get_global_slot(name);
+    if (slot >= 0) {
+      return Variable{.name = name,
+                      .type = codex->global_vars[slot].var.type,
+                      .scope = VarScope::GLOBAL,
+                      .slot = (uint32_t)slot};
+    }
+  }
+  for (size_t i = 0; i < module.module_vars.size(); i++) {
+    if (module.module_vars[i].var.name == name) {
+      return Variable{.name = name,
+                      .type = module.module_vars[i].var.type,
+                      .scope = VarScope::MODULE,
+                      .slot = (uint32_t)i};
+    }
+  }
+  auto [it, inserted] = local_slots.try_emplace(name, module.local_vars.size());
+  if (inserted) {
+    module.local_vars.push_back(name);
+  }
+  return Variable{.name = name, .scope = VarScope::LOCAL, .slot = it->second};
+}
+
 // SECTION: ERROR HANDLING
 
 void ParseState::err(const tao::pegtl::position pos, std::string msg) {
@@ -149,6 +176,11 @@ void ParseState::add_conditional_atom(const ConditionalAtom &atom) {
 }
 
 // SECTION: METHODS
+void ParseState::prepare_call(MethodCall &m) {
+  m.key = key_for_call(m);
+  m.method_index = codex ? codex->get_method_index(m.method) : -1;
+}
+
 void ParseState::validate_method(const MethodCall &m,
                                  const tao::pegtl::position pos) {
   // 1. There must be a codex
@@ -158,17 +190,12 @@ void ParseState::validate_method(const MethodCall &m,
   }
 
   // 2. Is method in codex?
-  const MethodDef *def = nullptr;
-  for (size_t i = 0; i < codex->method_defs.size(); i++) {
-    if (codex->method_defs[i].name == m.method) {
-      def = &codex->method_defs[i];
-      break;
-    }
-  }
-  if (!def) {
+  int index = codex->get_method_index(m.method);
+  if (index < 0) {
     err(pos, "No method by that name is in the Codex.");
     return;
   }
+  const MethodDef *def = &codex->method_defs[index];
 
   // 3. Arg count match
   if (m.args.size() != def->args.size()) {
@@ -3,6 +3,7 @@
 #include "tao/pegtl/position.hpp"
 #include <optional>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace Skald {
@@ -38,6 +39,14 @@ struct ParseState {
   bool declaration_was_valued;
   std::vector<DeclaredVar> module_vars_stack;
 
+  /** Local var name -> slot (index into module.local_vars) */
+  std::unordered_map<std::string, uint32_t> local_slots;
+
+  /** Resolves a variable reference to its scope and slot: a codex global,
+   *  then a declared module var, and otherwise a local, which is given a new
+   *  slot the first time the name comes up. */
+  Variable resolve_var(const std::string &name);
+
   // SECTION: TOP MATTER
 
   enum TopMatterSection { NONE, TESTBED, LET };
@@ -108,6 +117,10 @@ struct ParseState {
   /** Stores the raw member body until we can assemble it */
   std::optional<MemberBody> member_body_buffer;
 
+  /** Fills in what the engine precomputes for a call: its query key and its
+   *  index in the codex. */
+  void prepare_call(MethodCall &m);
+
   /** Validates a method and adds errors to the stack if any are found */
   void validate_method(const MethodCall &m, const tao::pegtl::position pos);
 
@@ -0,0 +1,60 @@
+#include "prefetch_pool.h"
+
+namespace Skald {
+
+PrefetchPool::PrefetchPool(size_t threads, size_t max_queued)
+    : max_queued(max_queued) {
+  for (size_t i = 0; i < threads; i++) {
+    workers.emplace_back([this] { work(); });
+  }
+}
+
+PrefetchPool::~PrefetchPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+    queue.clear();
+  }
+  wake.notify_all();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+PrefetchPool &PrefetchPool::shared() {
+  // Parsing is mostly memory-bound; a couple of threads keep ahead of any
+  // player without crowding out the engines themselves.
+  static PrefetchPool pool(2, 64);
+  return pool;
+}
+
+bool PrefetchPool::submit(std::weak_ptr<const void> owner,
+                          std::function<void()> job) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (stopping || queue.size() >= max_queued)
+      return false;
+    queue.push_back(Job{.owner = std::move(owner), .run = std::move(job)});
+  }
+  wake.notify_one();
+  return true;
+}
+
+void PrefetchPool::work() {
+  while (true) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [&] { return stopping || !queue.empty(); });
+      if (stopping)
+        return;
+      job = std::move(queue.front());
+      queue.pop_front();
+    }
+    if (job.owner.expired())
+      continue; // Cancelled: the engine moved on before we got to it
+    job.run();
+  }
+}
+
+} // namespace Skald
@@ -0,0 +1,48 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Skald {
+
+/** A few background threads shared by every engine's module prefetches.
+ *  Submitting never blocks: past max_queued jobs, new ones are dropped, as a
+ *  prefetch is only a guess. A job is skipped if its owner is gone by the
+ *  time a worker takes it, so an engine cancels the prefetches it no longer
+ *  wants by dropping the owner it gave them. */
+class PrefetchPool {
+public:
+  PrefetchPool(size_t threads, size_t max_queued);
+  PrefetchPool(const PrefetchPool &) = delete;
+  PrefetchPool &operator=(const PrefetchPool &) = delete;
+
+  /** Lets running jobs finish; queued ones are dropped */
+  ~PrefetchPool();
+
+  static PrefetchPool &shared();
+
+  /** Queues job; false if the queue is full */
+  bool submit(std::weak_ptr<const void> owner, std::function<void()> job);
+
+private:
+  struct Job {
+    std::weak_ptr<const void> owner;
+    std::function<void()> run;
+  };
+
+  std::deque<Job> queue;
+  size_t max_queued;
+  bool stopping = false;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::vector<std::thread> workers;
+
+  void work();
+};
+
+} // namespace Skald
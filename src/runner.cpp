@@ -0,0 +1,115 @@
+#include "skald.h"
+#include <exception>
+#include <string>
+#include <variant>
+
+namespace Skald {
+
+EngineRunner::EngineRunner(Engine engine, size_t capacity)
+    : engine(std::move(engine)), commands(capacity), responses(capacity),
+      worker([this] { run(); }) {}
+
+EngineRunner::~EngineRunner() {
+  stopping = true;
+  {
+    std::lock_guard<std::mutex> lock(wake_mutex);
+  }
+  wake.notify_one();
+  worker.join();
+}
+
+bool EngineRunner::submit(RunnerCommand command) {
+  if (!commands.push(std::move(command)))
+    return false;
+  // Pairs with the fence in run(): either the worker sees the command when
+  // it checks before sleeping, or we see it waiting and wake it.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (waiting.load(std::memory_order_relaxed)) {
+    {
+      std::lock_guard<std::mutex> lock(wake_mutex);
+    }
+    wake.notify_one();
+  }
+  return true;
+}
+
+std::optional<Response> EngineRunner::poll() {
+  auto response = responses.pop();
+  if (!response)
+    return std::nullopt;
+  // As in submit(): the worker may be asleep waiting for the room this made
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (waiting.load(std::memory_order_relaxed)) {
+    {
+      std::lock_guard<std::mutex> lock(wake_mutex);
+    }
+    wake.notify_one();
+  }
+  return response;
+}
+
+void EngineRunner::run() {
+  while (!stopping) {
+    auto command = commands.pop();
+    if (!command) {
+      std::unique_lock<std::mutex> lock(wake_mutex);
+      waiting.store(true, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      wake.wait(lock, [&] { return stopping || !commands.empty(); });
+      waiting.store(false, std::memory_order_relaxed);
+      continue;
+    }
+
+    Response response = execute(*command);
+    // The poller is behind; hold the response until it catches up rather
+    // than drop it, asleep rather than spinning against it for the CPU.
+    while (!responses.push(std::move(response))) {
+      std::unique_lock<std::mutex> lock(wake_mutex);
+      waiting.store(true, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      wake.wait(lock, [&] { return stopping || !responses.full(); });
+      waiting.store(false, std::memory_order_relaxed);
+      if (stopping)
+        return;
+    }
+  }
+}
+
+Response EngineRunner::execute(RunnerCommand &command) {
+  try {
+    return std::visit(
+        [&](auto &cmd) -> Response {
+          using T = std::decay_t<decltype(cmd)>;
+          if constexpr (std::is_same_v<T, StartAt>) {
+            if (!cmd.module.empty()) {
+              auto res = engine.load(cmd.module);
+              if (!res.ok) {
+                for (auto &ex : res.exceptions) {
+                  if (ex.severity == ParseError::ERROR) {
+                    return Error(ERROR_LOADING_MODULE, ex.msg, ex.pos.line);
+                  }
+                }
+                return Error(ERROR_LOADING_MODULE,
+                             "Unknown error loading module: " + cmd.module, 0);
+              }
+            }
+            return cmd.tag.empty() ? engine.start() : engine.start_at(cmd.tag);
+          } else if constexpr (std::is_same_v<T, Action>) {
+            return engine.act(cmd.selection);
+          } else if constexpr (std::is_same_v<T, QueryAnswer>) {
+            return engine.answer(std::optional<QueryAnswer>(cmd));
+          } else if constexpr (std::is_same_v<T, TicketAnswer>) {
+            return engine.answer(cmd.ticket, cmd.answer);
+          } else if constexpr (std::is_same_v<T, Rewind>) {
+            return engine.rewind(cmd.steps);
+          }
+        },
+        command);
+  } catch (const std::exception &e) {
+    // Most likely a bound native throwing; nobody on this thread could
+    // catch it, so it goes back as a response instead.
+    return Error(ERROR_UNKNOWN, e.what(), 0);
+  }
+}
+
+} // namespace Skald
@@ -1,12 +1,20 @@
 #include "../include/skald.h"
+#include "binary_io.h"
 #include "codex_actions.h"
 #include "codex_grammar.h"
 #include "codex_parse_state.h"
+#include "compiler.h"
 #include "debug.h"
+#include "lazy_module.h"
+#include "mapped_file.h"
+#include "module_binary.h"
 #include "parse_state.h"
+#include "prefetch_pool.h"
 #include "skald_actions.h"
 #include "skald_grammar.h"
 #include "tao/pegtl/parse.hpp"
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
 #include <filesystem>
 #include <fstream>
@@ -15,8 +23,10 @@
 #include <optional>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <tao/pegtl.hpp>
 #include <tao/pegtl/contrib/trace.hpp>
+#include <unordered_set>
 #include <variant>
 #include <vector>
 
@@ -24,93 +34,93 @@ namespace pegtl = tao::pegtl;
 
 namespace Skald {
 
-// SECTION: UTIL
-
-/** Gets the current block for the cursor */
-Block &Engine::cursor_block() {
-  return current->blocks.at(cursor.current_block_index);
-}
-
-/** Gets current MainBlockMember (BM or CT) where we already know block */
-MainBlockMember &Engine::cursor_mbm(Block &block) {
-  return block.members.at(cursor.current_member_index);
-}
-
-/** Gets current MainBlockMember (BM or CT) from scratch */
-MainBlockMember &Engine::cursor_mbm() {
-  auto &block = cursor_block();
-  return cursor_mbm(block);
-}
-
-/** Gets current BlockMember (Mem or CG), including in a CT, where we already
- * know the parent MBM (which either is this, or is the parent) */
-BlockMember &Engine::cursor_bm(MainBlockMember &mbm) {
-  // Return BM if that's what this is
-  if (auto *bm = std::get_if<BlockMember>(&mbm)) {
-    return *bm;
-  }
-
-  // Otherwise step into the CG
-  assert(cursor.entered_thread_block); // Must have resolved a cond
-  auto &chain = std::get<ConditionalChain>(mbm);
-  auto &cb = chain.cond_blocks.at(cursor.thread_block);
-  return cb.members.at(cursor.thread_member);
-}
-
-/** Gets current BlockMember (Mem or CG), including in a CT, where we don't
- * know the parent MBM (which either is this, or is the parent) */
-BlockMember &Engine::cursor_bm() {
-  auto &mbm = cursor_mbm();
-  return cursor_bm(mbm);
-}
-
-/** Gets current member; may be MBM:BM:Mem, may be child, or may be child of a
- * choice in a CG. In this case we know the parent / superclass BM. */
-Member &Engine::cursor_mem(BlockMember &bm) {
-  if (auto *cg = std::get_if<ChoiceGroup>(&bm)) {
-    assert(cursor.choice_selection >= 0); // Must be in a choice
-    auto &choice = cg->choices.at(cursor.choice_selection); // get choice
-    return choice.members.at(cursor.choice_thread_index);
-  }
-  return std::get<Member>(bm);
-}
-
-/** Gets current member; may be MBM:BM:Mem, may be child, or may be child of a
- * choice in a CG. */
-Member &Engine::cursor_mem() {
-  auto &bm = cursor_bm();
-  return cursor_mem(bm);
-}
-
 // SECTION: STATE
 void Engine::init_state() {
   local_state.clear();
-  module_state.clear();
-  global_state.clear();
+  module_state.replace({});
+  module_slots.replace({});
+  // Deltas can't describe a wipe; the next save has to be a checkpoint
+  has_checkpoint = false;
+  clear_journal();
+  std::vector<SimpleRValue> globals;
   if (codex) {
     for (auto &var : codex->global_vars) {
-      global_state[var.var.name] = var.initial_value;
+      globals.push_back(var.initial_value);
+    }
+  }
+  global_state.replace(std::move(globals));
+  // A loaded module's bindings point into the state we just wiped.
+  if (current) {
+    build_state(*current);
+    if (current->lazy) {
+      bind_locals(lazy_local_vars(*current->lazy));
     }
   }
 }
 
 void Engine::build_state(const Module &module) {
-  local_state.clear();
+  module_binding.clear();
   for (auto &var : module.module_vars) {
-    auto it = module_state.find(var.var.name);
-    if (it == module_state.end()) {
-      module_state[var.var.name] = var.initial_value;
+    auto it = module_slots->find(var.var.name);
+    if (it == module_slots->end()) {
+      uint32_t index = module_state->size();
+      module_slots.write().emplace(var.var.name, index);
+      module_state.write().push_back(var.initial_value);
+      module_binding.push_back(index);
+      dirty_module_vars.mark(index);
       continue;
     }
+    module_binding.push_back(it->second);
     // SimpleRValue index order matches ValueType enum order
     // (string, bool, int, float).
-    auto existing_type = static_cast<ValueType>(it->second.index());
+    auto existing_type =
+        static_cast<ValueType>((*module_state)[it->second].index());
     if (existing_type != var.var.type) {
       warn("Module var '" + var.var.name +
                "' redeclared with different type; keeping existing value.",
            var.line_number);
     }
   }
+
+  // Locals start out unset, unless an earlier module declared the name, in
+  // which case it's that module var (threaded through GO).
+  local_state.assign(module.local_vars.size(), std::nullopt);
+  local_binding.clear();
+  for (auto &name : module.local_vars) {
+    auto it = module_slots->find(name);
+    local_binding.push_back(it != module_slots->end() ? it->second
+                                                      : NO_BINDING);
+  }
+}
+
+Engine Engine::fork() const {
+  Engine copy;
+  copy.codex = codex;
+  copy.current = current;
+  copy.segment = segment;
+  copy.reader_ = reader_;
+  copy.module_cache = module_cache;
+  copy.native_methods = native_methods;
+  copy.cache_policy = cache_policy;
+  copy.lazy_blocks = lazy_blocks;
+
+  // The big ones are shared until either engine writes to them
+  copy.global_state = global_state;
+  copy.module_state = module_state;
+  copy.module_slots = module_slots;
+  copy.query_cache = query_cache;
+
+  // Sized by the current module, not the story
+  copy.module_binding = module_binding;
+  copy.local_binding = local_binding;
+  copy.local_state = local_state;
+
+  copy.sandboxed = sandboxed;
+  copy.cursor = cursor;
+  copy.next_ticket = next_ticket;
+  copy.step = step;
+  copy.block_visit = block_visit;
+  return copy;
 }
 
 bool compare(SimpleRValue ra, SimpleRValue rb,
@@ -154,154 +164,146 @@ void Engine::warn(std::string tx, size_t ln) {
   warnings.push_back(Warning{.message = tx, .line_number = ln});
 }
 
-/** This extracts all queries needed to solve a Conditional. */
-std::vector<MethodCallGet> queries_for_conditional(const Conditional &cond) {
-
-  std::vector<MethodCallGet> result;
+// SECTION: RESOLVERS AND STATE
 
-  for (const auto &item : cond.items) {
-    if (auto *atom = std::get_if<ConditionalAtom>(&item)) {
-      const MethodCall *a = rval_get_call(atom->a);
-      const MethodCall *b = atom->b ? rval_get_call(*atom->b) : nullptr;
-      if (a)
-        result.push_back(
-            MethodCallGet{.call = *a, .line_number = a->line_number});
-      if (b)
-        result.push_back(
-            MethodCallGet{.call = *b, .line_number = b->line_number});
-
-    } else if (auto *nested =
-                   std::get_if<std::shared_ptr<Conditional>>(&item)) {
-      auto queries = queries_for_conditional(**nested);
-      result.insert(result.end(), queries.begin(), queries.end());
-    }
+Engine::VarRef Engine::var_ref(const Variable &var) const {
+  // Every scope is bounds-checked: a slot the engine has no storage for is
+  // one resolved against another codex or module, and must not alias.
+  auto module_ref = [&](uint32_t index) -> VarRef {
+    return {VarScope::MODULE, index, index < module_state->size()};
+  };
+  switch (var.scope) {
+  case VarScope::GLOBAL:
+    return {VarScope::GLOBAL, var.slot, var.slot < global_state->size()};
+  case VarScope::MODULE:
+    if (var.slot < module_binding.size())
+      return module_ref(module_binding[var.slot]);
+    return {VarScope::MODULE, 0, false};
+  case VarScope::LOCAL:
+    break;
   }
-
-  return result;
+  if (var.slot >= local_state.size() || var.slot >= local_binding.size())
+    return {VarScope::LOCAL, 0, false};
+  if (local_binding[var.slot] != NO_BINDING)
+    return module_ref(local_binding[var.slot]);
+  return {VarScope::LOCAL, var.slot, local_state[var.slot].has_value()};
 }
 
-/** This returns all the queries needed to resolve an AC (handles null case) */
-std::vector<MethodCallGet>
-queries_for_attached_condition(const AttachedCondition &c) {
-  if (c.condition) {
-    return queries_for_conditional(*c.condition);
-  } else {
-    return {};
+const SimpleRValue &Engine::var_value(const VarRef &ref) const {
+  switch (ref.scope) {
+  case VarScope::GLOBAL:
+    return (*global_state)[ref.index];
+  case VarScope::MODULE:
+    return (*module_state)[ref.index];
+  case VarScope::LOCAL:
+    break;
   }
+  return *local_state[ref.index];
 }
 
-std::vector<MethodCallGet> queries_for_mutation(const Mutation &m) {
-  if (m.rvalue) {
-    if (const MethodCall *call = rval_get_call(*m.rvalue)) {
-      return {MethodCallGet{.call = *call, .line_number = call->line_number}};
-    }
+void Engine::var_write(const VarRef &ref, SimpleRValue val) {
+  if (journaling && ref.scope != VarScope::LOCAL) {
+    journal.back().vars.emplace_back(ref, var_value(ref));
   }
-  return {};
-}
-
-/** Returns all queries needed to display a list of choices. Ops are handled
- *  on player picking a choice, so aren't queried here. */
-std::vector<MethodCallGet> queries_for_choice_group(const ChoiceGroup &group) {
-  std::vector<MethodCallGet> ret;
-  for (const auto &choice : group.choices) {
-    auto q = queries_for_attached_condition(choice.condition);
-    ret.insert(ret.end(), q.begin(), q.end());
+  switch (ref.scope) {
+  case VarScope::GLOBAL:
+    global_state.write()[ref.index] = std::move(val);
+    break;
+  case VarScope::MODULE:
+    module_state.write()[ref.index] = std::move(val);
+    break;
+  case VarScope::LOCAL:
+    local_state[ref.index] = std::move(val);
+    break;
   }
-  return ret;
+  mark_dirty(ref);
 }
 
-/** This is called in the Conditional beat phase, to check if the beat should
- * be processed at all */
-std::vector<MethodCallGet>
-queries_for_member_conditional(const BlockMember &mem) {
-  return std::visit(
-      [](const auto &value) -> std::vector<MethodCallGet> {
-        using T = std::decay_t<decltype(value)>;
-        if constexpr (std::is_same_v<T, Member>) {
-          return queries_for_attached_condition(value.ac);
-        } else if constexpr (std::is_same_v<T, ChoiceGroup>) {
-          return queries_for_choice_group(value);
-        }
-        return {};
-      },
-      mem);
-}
-
-// SECTION: RESOLVERS AND STATE
-
-std::array<Engine::ScopeMap, 3> Engine::scopes() {
-  return {{{VarScope::GLOBAL, global_state},
-           {VarScope::MODULE, module_state},
-           {VarScope::LOCAL, local_state}}};
-}
-
-/** Returns value for given var name. Checks global, then module, then ad-hoc
- *  state, in that order. Returns bool false if nothing found, and throws
- *  warning. */
-SimpleRValue Engine::var_get(const std::string var_name) {
-  for (auto &s : scopes()) {
-    auto it = s.map.find(var_name);
-    if (it != s.map.end())
-      return it->second;
-  }
-  warn("Getting value for " + var_name +
+/** Returns value for the given var. Returns bool false if nothing is set, and
+ *  throws warning. */
+SimpleRValue Engine::var_get(const Variable &var) {
+  auto ref = var_ref(var);
+  if (ref.found)
+    return var_value(ref);
+  warn("Getting value for " + var.name +
        ", and found nothing. Defaulting to `false`.");
   return false;
 }
 
-/** Sets var. Checks types against global, then module, then local state. If
- *  none are set, sets value as local var. */
-std::variant<Error, VarScope> Engine::var_set(const std::string var_name,
+/** Sets var, checking the type against its current value. If it isn't set
+ *  anywhere, sets value as local var. */
+std::variant<Error, VarScope> Engine::var_set(const Variable &var,
                                               const SimpleRValue &rval,
                                               size_t ln) {
-  auto t = srval_get_type(rval);
-
-  for (auto &s : scopes()) {
-    auto it = s.map.find(var_name);
-    if (it == s.map.end())
-      continue;
-    if (srval_get_type(it->second) != t) {
+  auto ref = var_ref(var);
+  if (ref.found) {
+    if (srval_get_type(var_value(ref)) != srval_get_type(rval)) {
       return Error(ERROR_TYPE_MISMATCH,
-                   "Tried to set " + std::string(scope_to_string(s.scope)) +
-                       " var " + var_name + " to " + rval_to_string(rval),
+                   "Tried to set " + std::string(scope_to_string(ref.scope)) +
+                       " var " + var.name + " to " + rval_to_string(rval),
                    ln);
     }
-    s.map[var_name] = rval;
-    return s.scope;
+    var_write(ref, rval);
+    return ref.scope;
+  }
+  // Only locals get defined on the fly; a global or module var without storage
+  // is one the module was parsed against but the engine no longer has.
+  if (var.scope != VarScope::LOCAL) {
+    return Error(ERROR_NO_GLOBAL,
+                 "Tried to set " + std::string(scope_to_string(var.scope)) +
+                     " var " + var.name + ", but it is no longer defined.",
+                 ln);
+  }
+
+  if (var.slot >= local_state.size()) {
+    return Error(ERROR_OUT_OF_BOUNDS,
+                 "Tried to set local var " + var.name +
+                     ", but the current module has no slot for it.",
+                 ln);
   }
 
   // Not found anywhere; define as local.
-  local_state[var_name] = rval;
+  local_state[var.slot] = rval;
   return VarScope::LOCAL;
 }
 
 /** Toggles a bool var in whichever scope (global, module, local) holds it. */
-std::variant<Error, VarScope> Engine::var_switch(const std::string var_name,
+std::variant<Error, VarScope> Engine::var_switch(const Variable &var,
                                                  size_t ln) {
-  for (auto &s : scopes()) {
-    auto it = s.map.find(var_name);
-    if (it == s.map.end())
-      continue;
-    auto b = srval_get_bool(it->second);
+  auto ref = var_ref(var);
+  if (ref.found) {
+    auto b = srval_get_bool(var_value(ref));
     if (!b) {
       return Error(ERROR_TYPE_MISMATCH,
-                   "Tried to switch " + var_name + ", but it is not a boolean.",
+                   "Tried to switch " + var.name + ", but it is not a boolean.",
                    ln);
     }
-    s.map[var_name] = !*b;
-    return s.scope;
+    var_write(ref, !*b);
+    return ref.scope;
+  }
+  if (var.scope != VarScope::LOCAL) {
+    return Error(ERROR_NO_GLOBAL,
+                 "Tried to switch " + std::string(scope_to_string(var.scope)) +
+                     " var " + var.name + ", but it is no longer defined.",
+                 ln);
   }
-  warn("Tried to switch " + var_name +
+  if (var.slot >= local_state.size()) {
+    return Error(ERROR_OUT_OF_BOUNDS,
+                 "Tried to switch local var " + var.name +
+                     ", but the current module has no slot for it.",
+                 ln);
+  }
+  warn("Tried to switch " + var.name +
            ", and found nothing. Setting it as a local variable to `false`.",
        ln);
-  local_state[var_name] = false;
+  local_state[var.slot] = false;
   return VarScope::LOCAL;
 }
 
 /** Will mathematically mutate a float or int. Errors if string or bool, or if
  * arg is string or bool. floats and ints can be used interchangeably (int -
  * float will round down). If sign is false, will subtract. */
-std::variant<Error, VarScope> Engine::var_add(const std::string var_name,
+std::variant<Error, VarScope> Engine::var_add(const Variable &var,
                                               const SimpleRValue &rval,
                                               bool sign, size_t ln) {
 
@@ -310,7 +312,7 @@ std::variant<Error, VarScope> Engine::var_add(const std::string var_name,
   if (arg_type != ValueType::INT && arg_type != ValueType::FLOAT) {
     return Error(ERROR_TYPE_MISMATCH,
                  "Tried to add non-numeric value " + rval_to_string(rval) +
-                     " to " + var_name + ".",
+                     " to " + var.name + ".",
                  ln);
   }
 
@@ -322,35 +324,32 @@ std::variant<Error, VarScope> Engine::var_add(const std::string var_name,
   if (!sign)
     arg_f = -arg_f;
 
-  // Global -> Module -> Local
-  for (auto &s : scopes()) {
-    auto it = s.map.find(var_name);
-    if (it == s.map.end())
-      continue;
-
-    // If int, convert arg to int and add
-    auto var_type = srval_get_type(it->second);
-    if (var_type == ValueType::INT) {
-      s.map[var_name] = *srval_get_int(it->second) + (int)arg_f;
-      return s.scope;
-    }
+  // If var not found, error
+  auto ref = var_ref(var);
+  if (!ref.found) {
+    return Error(ERROR_VAR_UNDEFINED,
+                 "Tried to add to undefined var " + var.name + ".", ln);
+  }
 
-    // Same but for floats
-    if (var_type == ValueType::FLOAT) {
-      s.map[var_name] = *srval_get_float(it->second) + arg_f;
-      return s.scope;
-    }
+  // If int, convert arg to int and add
+  auto &val = var_value(ref);
+  auto var_type = srval_get_type(val);
+  if (var_type == ValueType::INT) {
+    var_write(ref, *srval_get_int(val) + (int)arg_f);
+    return ref.scope;
+  }
 
-    // If we have the var but it's not a number, error
-    return Error(ERROR_TYPE_MISMATCH,
-                 "Tried to add to " + std::string(scope_to_string(s.scope)) +
-                     " var " + var_name + ", but it is not numeric.",
-                 ln);
+  // Same but for floats
+  if (var_type == ValueType::FLOAT) {
+    var_write(ref, *srval_get_float(val) + arg_f);
+    return ref.scope;
   }
 
-  // If var not found, error
-  return Error(ERROR_VAR_UNDEFINED,
-               "Tried to add to undefined var " + var_name + ".", ln);
+  // If we have the var but it's not a number, error
+  return Error(ERROR_TYPE_MISMATCH,
+               "Tried to add to " + std::string(scope_to_string(ref.scope)) +
+                   " var " + var.name + ", but it is not numeric.",
+               ln);
 }
 
 /** Resolves an rvalue (potentially including method calls or variables) down
@@ -361,16 +360,21 @@ SimpleRValue Engine::resolve_rval_to_simple(const RValue &rval) {
       [this](const auto &value) -> SimpleRValue {
         using T = std::decay_t<decltype(value)>;
         if constexpr (std::is_same_v<T, std::shared_ptr<MethodCall>>) {
-          auto key = key_for_call(*value);
-          auto it = query_cache.find(key);
-          auto val = it != query_cache.end() ? it->second : SimpleRValue{false};
-          if (it == query_cache.end()) {
-            warn("Tried to resolve query key " + key +
+          if (auto *native = native_for(*value)) {
+            auto ret = native_answer(*native, *value);
+            return ret ? *ret : SimpleRValue{false};
+          }
+          QueryKey scratch;
+          auto &key = query_key(*value, scratch);
+          auto it = query_cache->find(key);
+          if (it == query_cache->end() || !it->second.val) {
+            warn("Tried to resolve query key " + key.text +
                  " and got nothing; defaulting to `false`.");
+            return false;
           }
-          return val;
+          return *it->second.val;
         } else if constexpr (std::is_same_v<T, Variable>) {
-          return var_get(value.name);
+          return var_get(value);
         } else {
           return value;
         }
@@ -436,6 +440,97 @@ bool Engine::resolve_condition(const AttachedCondition &cond) {
   return resolve_condition(cond.condition);
 }
 
+CachePolicy Engine::policy_for(const MethodCall &call) const {
+  if (codex && call.method_index >= 0 &&
+      static_cast<size_t>(call.method_index) < codex->method_defs.size()) {
+    auto &policy = codex->method_defs[call.method_index].cache_policy;
+    if (policy)
+      return *policy;
+  }
+  return cache_policy;
+}
+
+const QueryKey &Engine::query_key(const MethodCall &call, QueryKey &scratch) {
+  bool literal = true;
+  for (auto &arg : call.args) {
+    literal = literal && !std::holds_alternative<Variable>(arg) &&
+              !std::holds_alternative<std::shared_ptr<MethodCall>>(arg);
+  }
+  if (literal) {
+    return call.key;
+  }
+  scratch.text = call.method;
+  for (auto &arg : call.args) {
+    // An unset var keys as the `false` it reads as, without a warning on
+    // every lookup
+    SimpleRValue val = false;
+    if (auto *var = std::get_if<Variable>(&arg)) {
+      auto ref = var_ref(*var);
+      if (ref.found)
+        val = var_value(ref);
+    } else {
+      val = resolve_rval_to_simple(arg);
+    }
+    scratch.text += "|" + rval_to_string(val);
+  }
+  scratch.hash = std::hash<std::string>{}(scratch.text);
+  return scratch;
+}
+
+bool Engine::is_answered(const MethodCall *call) {
+  if (native_for(*call) || cursor.was_answered(call)) {
+    return true;
+  }
+  QueryKey scratch;
+  auto it = query_cache->find(query_key(*call, scratch));
+  if (it == query_cache->end()) {
+    return false;
+  }
+  if (sandboxed) {
+    return true; // A preview takes whatever it can get
+  }
+  switch (policy_for(*call)) {
+  case CachePolicy::NEVER:
+    return false;
+  case CachePolicy::PER_BEAT:
+    return it->second.step == step;
+  case CachePolicy::PER_BLOCK:
+    return it->second.block_visit == block_visit;
+  case CachePolicy::PURE:
+    return true;
+  }
+  return false;
+}
+
+const MethodCall *Engine::next_query(const Conditional &cond, bool &result) {
+  for (auto &item : cond.items) {
+    bool item_result;
+    if (auto *atom = std::get_if<ConditionalAtom>(&item)) {
+      const MethodCall *call = rval_get_call(atom->a);
+      if (call && !is_answered(call))
+        return call;
+      bool has_b = atom->comparison != ConditionalAtom::TRUTHY &&
+                   atom->comparison != ConditionalAtom::NOT_TRUTHY;
+      call = has_b && atom->b ? rval_get_call(*atom->b) : nullptr;
+      if (call && !is_answered(call))
+        return call;
+      item_result = resolve_conditional_atom(*atom);
+    } else {
+      auto &nested = std::get<std::shared_ptr<Conditional>>(item);
+      if (auto *call = next_query(*nested, item_result))
+        return call;
+    }
+
+    // Same short-circuit rules as resolve_condition
+    if (item_result == (cond.type == Conditional::OR)) {
+      result = item_result;
+      return nullptr;
+    }
+  }
+  result = cond.type == Conditional::AND;
+  return nullptr;
+}
+
 /** Internal helper function to print values as an engine output */
 std::string string_for_val(SimpleRValue val) {
   return std::visit(
@@ -474,7 +569,7 @@ std::string Engine::resolve_tern(const TernaryInsertion &tern) {
   return "";
 }
 
-std::variant<Error, Notification> Engine::do_mutation(Mutation &o) {
+std::variant<Error, Notification> Engine::do_mutation(const Mutation &o) {
   std::variant<Error, VarScope> res = VarScope::LOCAL;
   std::optional<SimpleRValue> rv;
   if (o.rvalue)
@@ -501,94 +596,88 @@ std::variant<Error, Notification> Engine::do_mutation(Mutation &o) {
   }
   VarScope s = *std::get_if<VarScope>(&res);
   return Notification{
-      .var_name = o.lvalue,
+      .var_name = o.lvalue.name,
       .mut_type = o.type,
       .rval = rv,
       .scope = s,
   };
 }
 
-std::optional<Response> Engine::do_member(Member &mem) {
-  std::optional<Response> ret;
-  std::visit(
-      [&](auto &m) {
-        using T = std::decay_t<decltype(m)>;
-        if constexpr (std::is_same_v<T, Beat>) {
-          /// BEAT ///
-          auto content = Content{};
-          content.text = resolve_text(m.content);
-          content.attribution = m.attribution;
-          ret = std::move(content);
-        } else if constexpr (std::is_same_v<T, Move>) {
-          /// MOVE ///
-          cursor.queued_transition = m.target_tag;
-        } else if constexpr (std::is_same_v<T, MethodCall>) {
-          /// METHOD ///
-          dbg_out("   -()() METHOD CALL POST");
-          ret = MethodCallPost{.call = m, .line_number = m.line_number};
-        } else if constexpr (std::is_same_v<T, Mutation>) {
-          /// MUTATION ///
-          auto mres = do_mutation(m);
-          std::visit([&](auto &v) { ret = v; }, mres);
-          dbg_out("    -o-o MUTATION");
-        } else if constexpr (std::is_same_v<T, GoModule>) {
-          /// GO ///
-          dbg_out("    --->> CHANGING MODULE");
-          cursor.queued_go = &m;
-          ret = *cursor.queued_go;
-        } else if constexpr (std::is_same_v<T, Exit>) {
-          /// EXIT ///
-          dbg_out("    ---X EXITING");
-          cursor.queued_exit = &m;
-          ret = *cursor.queued_exit;
-        }
-      },
-      mem.body);
-  return ret;
+const Program &Engine::program() const {
+  return segment ? segment->program : current->program;
 }
 
-/** Set up member (AC, mutation RValues. method args not supported yet) */
-void Engine::setup_member(Member &member) {
-  cursor.add_to_res_stack(queries_for_attached_condition(member.ac));
-  if (auto *mut = std::get_if<Mutation>(&member.body)) {
-    cursor.add_to_res_stack(queries_for_mutation(*mut));
+/** Moves the cursor onto an instruction, queueing the queries needed to run
+ *  it. Called on every cursor movement and on first enter. */
+void Engine::setup(uint32_t pc) {
+  cursor.pc = pc;
+  auto &ins = program().code[pc];
+  dbg_out("Engine::setup " << pc << ": " << ins.dbg_desc());
+  if (ins.op == Instruction::ENTER) {
+    // Only the seam between two lazily loaded blocks: next() goes on into
+    // the next one, which is the step, as it is without the seam
+    cursor.resolution_stack.clear();
+    cursor.answered.clear();
+    cursor.native_results.clear();
+    return;
   }
-  dbg_out("Engine::setup_member");
-  cursor.is_preprocessed = true;
-}
-
-/** Sets up a block member (CG or Mem) directly */
-void Engine::setup_bm(BlockMember &member) {
-  if (auto *cg = std::get_if<ChoiceGroup>(&member)) {
-    cursor.add_to_res_stack(queries_for_choice_group(*cg));
+  step++;
+  if (ins.block_start) {
+    block_visit++;
   }
-
-  dbg_out("Engine::setup_bm");
-  cursor.resolution_stack = queries_for_member_conditional(member);
-  cursor.is_preprocessed = true;
+  cursor.answered.clear();
+  cursor.native_results.clear();
+  queue_queries();
 }
 
-/** Queues the member's conditional for processing. Called on cursor movement
- * and by the engine on first enter. */
-void Engine::setup_mbm(MainBlockMember &mbm) {
-  dbg_out("Engine::setup_mbm");
-
-  /// ENTER CONDITIONAL CHAIN ///
-  if (auto *cc = std::get_if<ConditionalChain>(&mbm)) {
-    assert(!cursor.entered_thread_block); // must not already be in cond thread
-    cursor.thread_block = 0;
-    cursor.thread_member = 0;
-    cursor.entered_thread_block = false;
-    auto &cb = cc->cond_blocks[cursor.thread_block];
-    assert(cb.cond); // First cond block must not be an else
-    cursor.resolution_stack = queries_for_attached_condition(cb.cond);
-    cursor.is_preprocessed = true;
+/** Only the next call each condition needs gets queued, so a query behind a
+ *  false AND (or a true OR) is never asked. A choice group queues one per
+ *  choice, since every choice's condition has to be resolved; unless the
+ *  policy is NEVER, choices waiting on the same key share one query. */
+void Engine::queue_queries() {
+  cursor.resolution_stack.clear();
+  auto &ins = program().code[cursor.pc];
+
+  // Nothing to ask if every call the manifest lists is already answered (or
+  // bound natively); skip evaluating the conditions at all.
+  auto &queries = program().queries;
+  bool any_unanswered = false;
+  for (uint32_t i = 0; i < ins.query_count && !any_unanswered; i++) {
+    any_unanswered = !is_answered(queries[ins.query_begin + i]);
+  }
+  if (!any_unanswered) {
     return;
   }
-
-  /// OTHERWISE: BLOCK MEMBER ///
-  auto &bm = std::get<BlockMember>(mbm);
-  setup_bm(bm);
+  bool result;
+  auto queue = [&](const Conditional &cond) {
+    auto *call = next_query(cond, result);
+    if (!call)
+      return;
+    QueryKey scratch;
+    auto &key = query_key(*call, scratch);
+    if (policy_for(*call) != CachePolicy::NEVER) {
+      for (auto &queued : cursor.resolution_stack) {
+        if (queued.key == key)
+          return;
+      }
+    }
+    cursor.resolution_stack.push_back({call, next_ticket++, key});
+  };
+  switch (ins.op) {
+  case Instruction::CHOICES:
+    for (auto &choice : ins.group->choices) {
+      if (choice.condition)
+        queue(*choice.condition.condition);
+    }
+    break;
+  case Instruction::BRANCH:
+    queue(*ins.cond);
+    break;
+  default:
+    if (ins.ac)
+      queue(*ins.ac->condition);
+    break;
+  }
 }
 
 std::vector<Chunk> Engine::resolve_text(const TextContent &text_content) {
@@ -615,37 +704,18 @@ std::vector<Chunk> Engine::resolve_text(const TextContent &text_content) {
   return ret;
 }
 
-/** Advances the cursor one beat.
+/** Advances the cursor one instruction, or into the next module if a GO is
+ *  queued.
  *  - from_line_number is for error logging.
  */
 std::optional<Error> Engine::advance_cursor(int from_line_number) {
 
-  /// HANDLE TRANSITIONS ///
-
-  if (cursor.queued_transition.length() > 0) {
-    auto new_index = current->get_block_index(cursor.queued_transition);
-    if (new_index == -1)
-      return Error(ERROR_MODULE_TAG_NOT_FOUND,
-                   "Module tag not found: " + cursor.queued_transition,
-                   from_line_number);
-
-    cursor.current_block_index = new_index;
-    cursor.entered_thread_block = false;
-    cursor.thread_block = 0;
-    cursor.thread_member = 0;
-    cursor.choice_selection = -1; // Drop out of choice as well
-    cursor.choice_thread_index = 0;
-
-    // Start "above the top" of the next block in order to handle empty
-    // blocks where we immediately move to the next one.
-    cursor.current_member_index = -1;
-    cursor.queued_transition = "";
-  }
-
   /// GO TO MODULE ///
 
   if (cursor.queued_go) {
-    auto res = load(cursor.queued_go->module_path);
+    // Copy out first: loading replaces the module the GO lives in.
+    GoModule go = *cursor.queued_go;
+    auto res = load(go.module_path);
     if (!res.ok) {
       // Just use first error; that's what failed it
       for (auto &ex : res.exceptions) {
@@ -653,69 +723,36 @@ std::optional<Error> Engine::advance_cursor(int from_line_number) {
           return Error(ERROR_LOADING_MODULE, ex.msg, ex.pos.line);
         }
       }
-      return Error(
-          ERROR_LOADING_MODULE,
-          "Unknown error loading module: " + cursor.queued_go->module_path, 0);
-    }
-    auto tag = cursor.queued_go->start_in_tag;
-    if (tag.length() > 0) {
-      start_at(tag);
-    } else {
-      start();
+      return Error(ERROR_LOADING_MODULE,
+                   "Unknown error loading module: " + go.module_path, 0);
     }
-    cursor.current_member_index = -1;
-  }
-
-  // CHECK: Does a CC work if it's the first child following a transition?
-
-  /// CONDITIONAL CHAINS ///
-  if (cursor.current_member_index >= 0) {
-    //
-    auto &cc_mbm = cursor_mbm();
-    if (auto *cc = std::get_if<ConditionalChain>(&cc_mbm)) {
-      // Then advance through chain
-      assert(cc->cond_blocks.size() > cursor.thread_block);
-      auto &cb = cc->cond_blocks[cursor.thread_block];
-      assert(cb.members.size() > cursor.thread_member); // must start in bounds
-      cursor.thread_member++;
-      if (cb.members.size() > cursor.thread_member) {
-        auto &mem = cb.members[cursor.thread_member];
-        setup_bm(mem);
-        return std::nullopt;
-      } else {
-        // End of block; we exit.
-        cursor.entered_thread_block = false;
-        cursor.thread_member = 0;
-        cursor.thread_block = 0;
+    size_t block = 0;
+    if (go.start_in_tag.length() > 0) {
+      auto index = current->get_block_index(go.start_in_tag);
+      if (index < 0) {
+        return Error(ERROR_MODULE_TAG_NOT_FOUND,
+                     "No block was found for tag: " + go.start_in_tag,
+                     from_line_number);
       }
+      block = index;
+    } else if (current->blocks.size() < 1) {
+      return Error(ERROR_EMPTY_MODULE,
+                   "No blocks were found in the current module!", 0);
     }
+    return enter_block(block);
   }
 
-  /// NORMAL MEMBERS ///
-  cursor.current_member_index++; // aka will -> 0 after a transition
+  /// NEXT INSTRUCTION ///
 
-  /// END OF BLOCKS ///
-  Block *block = &cursor_block();
-  while (cursor.current_member_index >= block->members.size()) {
-    cursor.current_block_index++;
-    cursor.current_member_index = 0;
-    if (cursor.current_block_index >= current->blocks.size()) {
-      return Error(ERROR_EOF, "Unexpectedly reached the end of the file",
-                   from_line_number);
-    }
-    block = &cursor_block();
+  // Block ends fall through into the next block; past the last one is END.
+  auto &code = program().code;
+  if (cursor.pc + 1 >= code.size() ||
+      code[cursor.pc + 1].op == Instruction::END) {
+    return Error(ERROR_EOF, "Unexpectedly reached the end of the file",
+                 from_line_number);
   }
-
-  // If we get here, that means the block has members.
-
-  dbg_out("   +C => " << cursor.current_block_index << ", "
-                      << cursor.current_member_index);
-
-  // Queue up any conditional queries etc needed to run our next member
-  auto &mbm = cursor_mbm(*block);
-  setup_mbm(mbm);
-
-  // And return ok.
+  setup(cursor.pc + 1);
+  dbg_out("   +C => " << cursor.pc);
   return std::nullopt;
 }
 
@@ -729,7 +766,7 @@ Response Engine::next() {
   int debug_blocker = 0;
 
   // This will loop forever until something returns. Basically steps through
-  // the module until something happens, or until we need to return an error.
+  // the program until something happens, or until we need to return an error.
   while (true) {
 
     // Debug stopper; while developing, lock loop iterations to 50 to keep
@@ -755,111 +792,99 @@ Response Engine::next() {
     /// Query Stack ///
 
     if (cursor.resolution_stack.size() > 0) {
-      return cursor.resolution_stack.back();
+      auto &pending = cursor.resolution_stack.back();
+      return MethodCallGet{.call = *pending.call,
+                           .line_number = pending.call->line_number,
+                           .ticket = pending.ticket,
+                           .key = pending.key};
     }
 
-    assert(cursor.is_preprocessed); // Queries already must be handled
+    /// Instructions ///
 
-    /// Conditional Chains ///
+    // Not hoisted: entering a lazily loaded block switches segments
+    const Instruction &ins = program().code[cursor.pc];
 
-    auto &mbm = cursor_mbm();
-    if (auto *cc = std::get_if<ConditionalChain>(&mbm)) {
-      // Get current cond block
-      assert(cc->cond_blocks.size() > cursor.thread_block);
-      auto &cb = cc->cond_blocks[cursor.thread_block];
-
-      // Resolve conditional (auto handles else also)
-      if (resolve_condition(cb.cond)) {
+    // A member whose inline conditional fails is skipped entirely
+    if (ins.ac && !resolve_condition(*ins.ac)) {
+      dbg_out("    -x- condition failed, skipping");
+      if (auto err = advance_cursor(ins.line_number))
+        return *err;
+      continue;
+    }
 
-        // Enter into this block (cursor.thread_block)
-        cursor.entered_thread_block = true;
+    switch (ins.op) {
+    case Instruction::BEAT: {
+      auto content = Content{};
+      content.text = resolve_text(ins.beat->content);
+      content.attribution = ins.beat->attribution;
+      return content;
+    }
+    case Instruction::CALL:
+      if (auto *native = sandboxed ? nullptr : native_for(*ins.call)) {
+        dbg_out("   -()() NATIVE METHOD CALL");
+        call_native(*native, *ins.call);
+        if (auto err = advance_cursor(ins.line_number))
+          return *err;
+        continue;
+      }
+      dbg_out("   -()() METHOD CALL POST");
+      return MethodCallPost{.call = *ins.call,
+                            .line_number = ins.call->line_number};
+    case Instruction::MUTATE: {
+      dbg_out("    -o-o MUTATION");
+      auto mres = do_mutation(*ins.mutation);
+      if (auto *err = std::get_if<Error>(&mres)) {
+        return *err;
+      }
+      return std::get<Notification>(mres);
+    }
+    case Instruction::GO:
+      dbg_out("    --->> CHANGING MODULE");
+      cursor.queued_go = ins.go;
+      return *cursor.queued_go;
+    case Instruction::EXIT:
+      dbg_out("    ---X EXITING");
+      cursor.queued_exit = ins.exit;
+      return *cursor.queued_exit;
+    case Instruction::MOVE: {
+      // Unlinked targets were reported by load(); still refuse to run them.
+      if (ins.target == Instruction::NO_TARGET)
+        return Error(ERROR_MODULE_TAG_NOT_FOUND,
+                     "Module tag not found: " + ins.move->target_tag,
+                     ins.line_number);
+      if (current->lazy) {
+        if (auto err = go_to_block(ins.target))
+          return *err;
       } else {
-        cursor.thread_block++;
-
-        // If at end of thread, just drop out
-        if (cursor.thread_block >= cc->cond_blocks.size()) {
-          auto err = advance_cursor();
-          if (err)
-            return *err;
-          continue;
-        } else {
-          // Get the next block in line
-          auto &nb = cc->cond_blocks[cursor.thread_block];
-
-          // else block (no conditional)?
-          if (!nb.cond) {
-            cursor.entered_thread_block = true;
-          } else {
-            // elseif block: add to res stack and loop de loop.
-            cursor.resolution_stack = queries_for_attached_condition(nb.cond);
-            continue; // Will get resolved on next main loop iteration
-          }
-        }
+        setup(ins.target);
       }
+      continue;
+    }
+    case Instruction::CHOICES: {
+      dbg_out("next(): hit a ChoiceGroup, returning OG");
+      auto grp = OptionGroup{};
+      for (auto &choice : ins.group->choices) {
+        auto opt = Option{};
+        opt.text = resolve_text(choice.content);
+        opt.is_available = resolve_condition(choice.condition);
+        grp.options.push_back(opt);
+      }
+      return grp;
+    }
+    case Instruction::BRANCH:
+      // Queries are already resolved; fall into the block or skip past it.
+      setup(resolve_condition(*ins.cond) ? cursor.pc + 1 : ins.target);
+      continue;
+    case Instruction::JUMP:
+      setup(ins.target);
+      continue;
+    case Instruction::ENTER:
+      if (auto err = go_to_block(ins.target))
+        return *err;
+      continue;
+    case Instruction::END:
+      return Error(ERROR_EOF, "Unexpectedly reached the end of the file", 0);
     }
-
-    /// Block Logic and Interaction ///
-    auto &bm = cursor_bm(mbm);
-
-    std::optional<Response> response = std::visit(
-        [&](auto &mem) -> std::optional<Response> {
-          using T = std::decay_t<decltype(mem)>;
-          if constexpr (std::is_same_v<T, Member>) {
-            /// NORMAL MEMBERS ///
-            return do_member(mem);
-          } else if constexpr (std::is_same_v<T, ChoiceGroup>) {
-            /// CHOICE GROUPS ///
-            dbg_out(
-                "next -> visit ChoiceGroup. c_s=" << cursor.choice_selection);
-
-            // Execute choice if we made one
-            if (cursor.choice_selection >= 0) {
-              assert(mem.choices.size() >
-                     cursor.choice_selection); // Must be selectable
-              Choice &choice = mem.choices[cursor.choice_selection];
-
-              if (cursor.choice_thread_index >= choice.members.size()) {
-                dbg_out("passed end of choice member list, resetting and "
-                        "moving on (c_t_i = 0)");
-                cursor.choice_selection = -1;
-                cursor.choice_thread_index = 0;
-                return std::nullopt;
-              }
-
-              // Automatically step through members as we hit this. Note that
-              // this means a transition will kick us fully out of this process.
-              assert(cursor.choice_thread_index < choice.members.size());
-              dbg_out(">>> processing choice member at c_t_i:"
-                      << cursor.choice_thread_index);
-              auto res = do_member(choice.members[cursor.choice_thread_index]);
-              cursor.choice_thread_index++;
-              return res;
-            }
-
-            dbg_out("next(): hit a ChoiceGroup w/ sel = -1, returning OG");
-            auto grp = OptionGroup{};
-            for (auto &choice : mem.choices) {
-              auto opt = Option{};
-              opt.text = resolve_text(choice.content);
-              opt.is_available = resolve_condition(choice.condition);
-              grp.options.push_back(opt);
-            }
-            return grp;
-          }
-          return std::nullopt;
-        },
-        bm);
-
-    // If we got something out of the member, return it; otherwise loop de
-    // loop.
-    if (response)
-      return *response;
-
-    // If no response, step forward
-    dbg_out("----> advancing cursor ...");
-    auto err = advance_cursor();
-    if (err)
-      return *err;
   } // end of main next() loop.
 
   return Error(ERROR_UNKNOWN,
@@ -871,64 +896,77 @@ Response Engine::next() {
 
 /** Called by client on continue (`act(0)`) or choice (`act(n)`). */
 Response Engine::act(int choice_index) {
+  if (journal_limit > 0 && !journaling) {
+    return journaled([&] { return act(choice_index); });
+  }
   dbg_out("\n>! Engine::act(" << choice_index << ")");
-  auto &bm = cursor_bm();
-  std::optional<Error> err;
-  std::visit(
-      [&](const auto &mem) {
-        using T = std::decay_t<decltype(mem)>;
-        if constexpr (std::is_same_v<T, Member>) {
-
-          /// Act on a beat: CONTINUE ///
-          err = advance_cursor(mem.line_number);
-
-        } else if constexpr (std::is_same_v<T, ChoiceGroup>) {
-
-          // If choice_selection is already made, this is stepping through.
-          if (cursor.choice_selection >= 0) {
-            // TODO: Consider turning this into an actual error
-            assert(choice_index == 0); // No choices available in a choice block
-            return;
-          }
-
-          /// Act on a choice group: CHOICE ///
-
-          if (choice_index >= mem.choices.size()) {
-            err = Error(ERROR_CHOICE_OUT_OF_BOUNDS,
-                        "You picked choice " + std::to_string(choice_index) +
-                            ", but there are only " +
-                            std::to_string(mem.choices.size()) +
-                            " choices available!",
-                        mem.line_number);
-            return;
-          }
-
-          auto &choice = mem.choices[choice_index];
+  if (!current) {
+    return Error(ERROR_UNEXPECTED_ACT, "No module is loaded!", 0);
+  }
+  // A lazily loaded module runs nothing until a block is entered
+  if (program().code.empty()) {
+    return Error(ERROR_UNEXPECTED_ACT, "No block has been entered yet!", 0);
+  }
+  auto &ins = program().code[cursor.pc];
 
-          // Make sure the selection is valid
-          if (!resolve_condition(choice.condition)) {
-            err = Error(ERROR_CHOICE_UNAVAILABLE,
-                        "You picked choice " + std::to_string(choice_index) +
-                            ", but it is unavailable.",
-                        choice.line_number);
+  if (ins.op != Instruction::CHOICES) {
+    /// Act on anything else: CONTINUE ///
+    auto err = advance_cursor(ins.line_number);
+    if (err)
+      return *err;
+    return next();
+  }
 
-            return;
-          }
+  /// Act on a choice group: CHOICE ///
 
-          // Process any queries that are needed
-          cursor.choice_selection = choice_index;
-          cursor.choice_thread_index = 0;
-        }
-      },
-      bm);
+  auto &choices = ins.group->choices;
+  if (choice_index < 0 || choice_index >= choices.size()) {
+    return Error(ERROR_CHOICE_OUT_OF_BOUNDS,
+                 "You picked choice " + std::to_string(choice_index) +
+                     ", but there are only " + std::to_string(choices.size()) +
+                     " choices available!",
+                 ins.line_number);
+  }
 
-  // Handle any errors thrown by the members
-  if (err)
-    return *err;
+  // Make sure the selection is valid
+  auto &choice = choices[choice_index];
+  if (!resolve_condition(choice.condition)) {
+    return Error(ERROR_CHOICE_UNAVAILABLE,
+                 "You picked choice " + std::to_string(choice_index) +
+                     ", but it is unavailable.",
+                 choice.line_number);
+  }
 
+  // Step into the choice's members
+  setup(program().choice_targets[ins.target + choice_index]);
   return next();
 }
 
+ChoicePreview Engine::preview(int choice_index, int max_steps) const {
+  ChoicePreview ret;
+  Engine sandbox = fork();
+  sandbox.sandboxed = true;
+
+  Response r = sandbox.act(choice_index);
+  for (int i = 0; i < max_steps; i++) {
+    if (auto *content = std::get_if<Content>(&r)) {
+      ret.content.push_back(*content);
+    } else if (auto *note = std::get_if<Notification>(&r)) {
+      ret.changes.push_back(*note);
+    } else if (auto *post = std::get_if<MethodCallPost>(&r)) {
+      ret.posts.push_back(*post);
+    } else {
+      if (std::holds_alternative<MethodCallGet>(r)) {
+        ret.unresolved = sandbox.pending_queries();
+      }
+      ret.stop = std::move(r);
+      break;
+    }
+    r = sandbox.act(0);
+  }
+  return ret;
+}
+
 Response Engine::answer(std::optional<QueryAnswer> answer) {
   if (cursor.resolution_stack.empty()) {
     return Error(ERROR_RESOLUTION_QUEUE_EMPTY,
@@ -938,24 +976,236 @@ Response Engine::answer(std::optional<QueryAnswer> answer) {
   auto &answering = cursor.resolution_stack.back();
   if (!answer) {
     return Error(ERROR_EXPECTED_ANSWER,
-                 "Expected an answer for " + answering.get_key() +
+                 "Expected an answer for " + answering.key.text +
                      ", but received none.",
-                 answering.line_number);
+                 answering.call->line_number);
+  }
+  return this->answer(answering.ticket, *answer);
+}
+
+std::vector<MethodCallGet> Engine::pending_queries() {
+  std::vector<MethodCallGet> ret;
+  for (auto &pending : cursor.resolution_stack) {
+    ret.push_back(MethodCallGet{.call = *pending.call,
+                                .line_number = pending.call->line_number,
+                                .ticket = pending.ticket,
+                                .key = pending.key});
+  }
+  return ret;
+}
+
+Response Engine::answer(uint32_t ticket, QueryAnswer answer) {
+  return answer_many({TicketAnswer{.ticket = ticket, .answer = answer}});
+}
+
+Response Engine::answer_many(const std::vector<TicketAnswer> &answers) {
+  if (journal_limit > 0 && !journaling) {
+    return journaled([&] { return answer_many(answers); });
+  }
+  auto &stack = cursor.resolution_stack;
+  if (stack.empty()) {
+    return Error(ERROR_RESOLUTION_QUEUE_EMPTY,
+                 "Received an answer, but the resolution queue is empty!", 0);
   }
-  auto key = answering.get_key();
-  auto a = *answer;
-  if (a.val) {
-    query_cache.insert_or_assign(key, *a.val);
-  } else {
-    query_cache.erase(key);
+  auto find = [&](uint32_t ticket) {
+    return std::find_if(stack.begin(), stack.end(),
+                        [&](auto &p) { return p.ticket == ticket; });
+  };
+
+  // Check every ticket before recording anything
+  for (auto &a : answers) {
+    if (find(a.ticket) == stack.end()) {
+      return Error(ERROR_UNKNOWN_TICKET,
+                   "Received an answer for ticket " + std::to_string(a.ticket) +
+                       ", but no pending query has it.",
+                   0);
+    }
+  }
+  for (auto &a : answers) {
+    auto it = find(a.ticket);
+    if (it == stack.end()) {
+      continue; // Answered twice in one batch
+    }
+    dirty_answers.insert(it->key);
+    if (journaling) {
+      auto old = query_cache->find(it->key);
+      journal.back().answers.emplace_back(
+          it->key, old != query_cache->end()
+                       ? std::optional<CachedAnswer>(old->second)
+                       : std::nullopt);
+    }
+    query_cache.write().insert_or_assign(
+        it->key, CachedAnswer{.val = a.answer.val,
+                              .step = step,
+                              .block_visit = block_visit});
+    cursor.answered.push_back(it->call);
+    stack.erase(it);
+  }
+
+  // Once this set is complete, conditions may need further queries
+  if (stack.empty()) {
+    queue_queries();
   }
-  cursor.resolution_stack.pop_back();
   return next();
 }
 
+// SECTION: REWIND
+
+/** Rough heap and inline size of a value, for the journal's budget */
+static size_t approx_bytes(const SimpleRValue &val) {
+  auto *str = std::get_if<std::string>(&val);
+  return sizeof(val) + (str ? str->size() : 0);
+}
+
+static size_t approx_bytes(const std::vector<Chunk> &text) {
+  size_t bytes = 0;
+  for (auto &chunk : text) {
+    bytes += sizeof(chunk) + chunk.text.size();
+  }
+  return bytes;
+}
+
+static size_t approx_bytes(const Response &response) {
+  size_t bytes = sizeof(response);
+  if (auto *content = std::get_if<Content>(&response)) {
+    bytes += content->attribution.size() + approx_bytes(content->text);
+  } else if (auto *group = std::get_if<OptionGroup>(&response)) {
+    for (auto &opt : group->options) {
+      bytes += sizeof(opt) + approx_bytes(opt.text);
+    }
+  }
+  return bytes;
+}
+
+void Engine::set_rewind_limit(size_t max_bytes) {
+  journal_limit = max_bytes;
+  if (journal_limit == 0) {
+    clear_journal();
+    return;
+  }
+  while (journal_bytes > journal_limit && journal.size() > 1) {
+    journal_bytes -= journal.front().bytes;
+    journal.pop_front();
+  }
+}
+
+size_t Engine::rewind_depth() const {
+  return journal.empty() ? 0 : journal.size() - 1;
+}
+
+void Engine::clear_journal() {
+  journal.clear();
+  journal_bytes = 0;
+}
+
+void Engine::begin_step() {
+  journaling = true;
+  auto &entry = journal.emplace_back();
+  entry.cursor = cursor;
+  entry.next_ticket = next_ticket;
+  entry.step = step;
+  entry.block_visit = block_visit;
+  entry.module = current;
+  entry.segment = segment;
+  entry.module_binding = module_binding;
+  entry.local_binding = local_binding;
+  entry.local_state = local_state;
+  entry.module_state_size = module_state->size();
+  entry.module_slots = module_slots;
+}
+
+void Engine::end_step(const Response &response) {
+  journaling = false;
+  auto &entry = journal.back();
+  entry.response = response;
+
+  size_t bytes = sizeof(entry) + approx_bytes(response);
+  bytes += entry.cursor.resolution_stack.size() * sizeof(Cursor::PendingQuery);
+  bytes += entry.cursor.answered.size() * sizeof(const MethodCall *);
+  for (auto &[call, val] : entry.cursor.native_results) {
+    bytes += sizeof(call) + (val ? approx_bytes(*val) : sizeof(val));
+  }
+  bytes += (entry.module_binding.size() + entry.local_binding.size()) *
+           sizeof(uint32_t);
+  for (auto &local : entry.local_state) {
+    bytes += local ? approx_bytes(*local) : sizeof(local);
+  }
+  for (auto &[ref, old] : entry.vars) {
+    bytes += sizeof(ref) + approx_bytes(old);
+  }
+  for (auto &[key, old] : entry.answers) {
+    bytes += sizeof(key) + key.text.size() + sizeof(old);
+    if (old && old->val) {
+      bytes += approx_bytes(*old->val);
+    }
+  }
+  entry.bytes = bytes;
+  journal_bytes += bytes;
+
+  // Always keep the latest: it holds the response to rewind back to
+  while (journal_bytes > journal_limit && journal.size() > 1) {
+    journal_bytes -= journal.front().bytes;
+    journal.pop_front();
+  }
+}
+
+void Engine::undo(JournalEntry &entry) {
+  for (auto it = entry.vars.rbegin(); it != entry.vars.rend(); ++it) {
+    var_write(it->first, std::move(it->second));
+  }
+  if (!entry.answers.empty()) {
+    auto &cache = query_cache.write();
+    for (auto it = entry.answers.rbegin(); it != entry.answers.rend(); ++it) {
+      if (it->second) {
+        cache.insert_or_assign(it->first, *it->second);
+      } else {
+        cache.erase(it->first);
+      }
+    }
+  }
+  if (module_state->size() > entry.module_state_size) {
+    auto &state = module_state.write();
+    state.erase(state.begin() + entry.module_state_size, state.end());
+  }
+  module_slots = std::move(entry.module_slots);
+
+  current = std::move(entry.module);
+  segment = std::move(entry.segment);
+  module_binding = std::move(entry.module_binding);
+  local_binding = std::move(entry.local_binding);
+  local_state = std::move(entry.local_state);
+  cursor = std::move(entry.cursor);
+  next_ticket = entry.next_ticket;
+  step = entry.step;
+  block_visit = entry.block_visit;
+}
+
+Response Engine::rewind(size_t n) {
+  if (n > rewind_depth() || journal.empty()) {
+    return Error(ERROR_NOTHING_TO_REWIND,
+                 "Tried to rewind " + std::to_string(n) + " steps, but only " +
+                     std::to_string(rewind_depth()) + " can be undone.",
+                 0);
+  }
+  for (size_t i = 0; i < n; i++) {
+    undo(journal.back());
+    journal_bytes -= journal.back().bytes;
+    journal.pop_back();
+  }
+  // A delta can't say an answer was uncached
+  has_checkpoint = false;
+  return journal.back().response;
+}
+
 // SECTION: MODULE ENTRY
 
 Response Engine::start_at(std::string tag) {
+  if (journal_limit > 0 && !journaling) {
+    return journaled([&] { return start_at(tag); });
+  }
+  if (!current) {
+    return Error(ERROR_EMPTY_MODULE, "No module is loaded!", 0);
+  }
   auto start_index = current->get_block_index(tag);
   if (start_index < 0) {
     return Error(ERROR_MODULE_TAG_NOT_FOUND,
@@ -965,7 +1215,13 @@ Response Engine::start_at(std::string tag) {
 }
 
 Response Engine::start() {
+  if (journal_limit > 0 && !journaling) {
+    return journaled([&] { return start(); });
+  }
   dbg_out("engine start");
+  if (!current) {
+    return Error(ERROR_EMPTY_MODULE, "No module is loaded!", 0);
+  }
   if (current->blocks.size() < 1) {
     return Error(ERROR_EMPTY_MODULE,
                  "No blocks were found in the current module!", 0);
@@ -975,28 +1231,92 @@ Response Engine::start() {
 
 Response Engine::enter(int block, int index) {
   dbg_out("Engine::enter");
-  cursor.reset();
-  build_state(*current);
-  cursor.current_block_index = block;
-  cursor.current_member_index = 0;
 
   // Ensure this has members
-  auto &b = cursor_block();
-  if (b.members.size() == 0) {
+  const Block *b = &current->blocks.at(block);
+  if (current->lazy) {
+    auto found = parsed_block(block);
+    if (auto *err = std::get_if<Error>(&found))
+      return *err;
+    b = &std::get<std::shared_ptr<const ParsedBlock>>(found)->block;
+  }
+  if (b->members.size() == 0) {
     return Error{ERROR_START_EMPTY_BLOCK,
-                 "You cannot enter into an empty block!", b.line_number};
+                 "You cannot enter into an empty block!",
+                 current->blocks[block].line_number};
   }
 
-  setup_mbm(cursor_mbm());
+  if (auto err = enter_block(block))
+    return *err;
   return next();
 }
 
+std::optional<Error> Engine::enter_block(size_t block) {
+  cursor.reset();
+  build_state(*current);
+  return go_to_block(block);
+}
+
+std::optional<Error> Engine::go_to_block(uint32_t block) {
+  if (!current->lazy) {
+    setup(current->program.block_entry[block]);
+    return std::nullopt;
+  }
+  auto found = parsed_block(block);
+  if (auto *err = std::get_if<Error>(&found)) {
+    return *err;
+  }
+  auto &parsed = std::get<std::shared_ptr<const ParsedBlock>>(found);
+
+  // Blocks parsed since we last looked may have added locals
+  if (local_state.size() < parsed->local_count) {
+    bind_locals(lazy_local_vars(*current->lazy));
+  }
+  if (prefetch && parsed != segment) {
+    prefetch_go_targets(parsed->program);
+  }
+  segment = std::move(parsed);
+  setup(0);
+  return std::nullopt;
+}
+
+std::variant<Error, std::shared_ptr<const ParsedBlock>>
+Engine::parsed_block(uint32_t block) {
+  bool parsed_now;
+  auto parsed = lazy_block(*current, block, &parsed_now);
+  if (!parsed->result.ok) {
+    // Just use first error; that's what failed it
+    for (auto &ex : parsed->result.exceptions) {
+      if (ex.severity == ParseError::ERROR) {
+        return Error(ERROR_PARSING_BLOCK, ex.msg, ex.pos.line);
+      }
+    }
+    return Error(ERROR_PARSING_BLOCK,
+                 "Unknown error parsing block: " + current->blocks[block].tag,
+                 current->blocks[block].line_number);
+  }
+  // Warned about once, by the engine that parsed it
+  if (parsed_now) {
+    for (auto &ex : parsed->result.exceptions) {
+      warn(ex.msg, ex.pos.line);
+    }
+  }
+  return parsed;
+}
+
+void Engine::bind_locals(const std::vector<std::string> &names) {
+  for (size_t i = local_binding.size(); i < names.size(); i++) {
+    auto it = module_slots->find(names[i]);
+    local_binding.push_back(it != module_slots->end() ? it->second
+                                                      : NO_BINDING);
+  }
+  local_state.resize(local_binding.size());
+}
+
 // SECTION: FILE LOADING AND PARSING
 
 // STUB: Initialize with module.
 
-// TODO: Serialize
-
 // Build basic fs reader to use by default
 std::optional<std::string> default_source_reader(const std::string &path) {
   if (!std::filesystem::exists(path)) {
@@ -1011,18 +1331,90 @@ std::optional<std::string> default_source_reader(const std::string &path) {
   return ss.str();
 }
 
+std::optional<SourceView> mapped_source_reader(const std::string &path) {
+  auto file = MappedFile::open(path);
+  if (!file) {
+    return std::nullopt;
+  }
+  return SourceView{.bytes = file->view(), .owner = file};
+}
+
+/** Lends a read-in source: the string becomes the view's owner, so it's
+ *  moved once and never copied. */
+static std::optional<SourceView> owned_view(std::optional<std::string> source) {
+  if (!source) {
+    return std::nullopt;
+  }
+  auto owned = std::make_shared<const std::string>(std::move(*source));
+  return SourceView{.bytes = *owned, .owner = owned};
+}
+
+/** Adapts a SourceReader into a SourceViewReader (see owned_view) */
+static SourceViewReader view_reader(SourceReader reader) {
+  if (!reader) {
+    return {};
+  }
+  return [reader = std::move(reader)](const std::string &path) {
+    return owned_view(reader(path));
+  };
+}
+
+static std::optional<SourceView> read_source(const std::string &file_path,
+                                             const SourceViewReader &reader) {
+  return reader ? reader(file_path)
+                : owned_view(default_source_reader(file_path));
+}
+
 void Engine::set_source_reader(SourceReader reader) {
+  reader_ = view_reader(std::move(reader));
+}
+
+void Engine::set_source_reader(SourceViewReader reader) {
   reader_ = std::move(reader);
 }
 
-ParseResult Engine::setup(std::string path) {
+void Engine::set_module_cache(std::shared_ptr<ModuleCache> cache) {
+  module_cache = std::move(cache);
+}
+
+void Engine::set_prefetch(bool enabled) {
+  prefetch = enabled;
+  if (!prefetch) {
+    prefetch_owner.reset();
+  } else if (!prefetch_owner) {
+    prefetch_owner = std::make_shared<const bool>(true);
+    if (current) {
+      prefetch_go_targets(program());
+    }
+  }
+}
+
+void Engine::set_lazy_blocks(bool enabled) { lazy_blocks = enabled; }
+
+Loaded<Codex> load_codex(const std::string &path, const SourceReader &reader) {
+  return load_codex(path, view_reader(reader));
+}
+
+Loaded<Codex> load_codex(const std::string &path,
+                         const SourceViewReader &reader) {
   try {
-    std::optional<std::string> source =
-        reader_ ? reader_(path) : default_source_reader(path);
+    std::optional<SourceView> source = read_source(path, reader);
     if (!source) {
-      return ParseResult::fail("File not found: " + path);
+      return {ParseResult::fail("File not found: " + path), nullptr};
+    }
+    if (is_compiled_codex(source->bytes)) {
+      std::filesystem::path p(path);
+      Codex codex{.path = p.parent_path().string(),
+                  .filename = p.filename().string()};
+      if (auto why = decode_codex(source->bytes, codex)) {
+        return {ParseResult::fail("Couldn't load compiled codex " + path +
+                                  ": " + *why),
+                nullptr};
+      }
+      return {ParseResult::with({}),
+              std::make_shared<const Codex>(std::move(codex))};
     }
-    pegtl::memory_input in(*source, path);
+    pegtl::memory_input in(source->bytes.data(), source->bytes.size(), path);
     CodexParseState pstate(path);
 
     dbg_out("------- CODEX PARSING ------");
@@ -1032,7 +1424,7 @@ ParseResult Engine::setup(std::string path) {
     } else {
       dbg_out("----------------------------");
       dbg_out("Codex parse failed!");
-      return ParseResult::fail("Codex parse failed!");
+      return {ParseResult::fail("Codex parse failed!"), nullptr};
     }
 
     dbg_out(">>> Parse results:\n");
@@ -1047,33 +1439,60 @@ ParseResult Engine::setup(std::string path) {
       dbg_out(" - " << def.dbg_desc());
     }
 
-    // Grab the finished module from the parse state
-    codex = std::make_unique<Codex>(std::move(pstate.codex));
-
-    // Initialize state with the new codex (wipes prior state)
-    init_state();
-    return ParseResult::with(std::move(pstate.errors));
+    // Grab the finished codex from the parse state
+    auto codex = std::make_shared<const Codex>(std::move(pstate.codex));
     dbg_out(">>> codex_path() = " << codex->codex_path());
+    return {ParseResult::with(std::move(pstate.errors)), std::move(codex)};
   } catch (const pegtl::parse_error &e) {
     dbg_out("Codex parse error: " << e.what());
-    return ParseResult::fail(e.what());
+    return {ParseResult::fail(e.what()), nullptr};
   } catch (const std::exception &e) {
     dbg_out("Codex error: " << e.what());
-    return ParseResult::fail(e.what());
+    return {ParseResult::fail(e.what()), nullptr};
   }
 }
 
-ParseResult Engine::load(std::string path) {
+static uint64_t hash_source(std::string_view source) {
+  return fnv1a(source.data(), source.size());
+}
+
+/** Parses, links and compiles module source that's already been read.
+ *  file_path is the resolved path, for positions in errors. The source is
+ *  only borrowed; nothing in the module points into it. */
+static Loaded<Module> parse_module(const std::string &path,
+                                   const std::string &file_path,
+                                   std::string_view source,
+                                   std::shared_ptr<const Codex> codex,
+                                   bool lazy_blocks) {
   try {
-    // Resolve project paths against the codex root: "alice.ska" with codex
-    // ~/bob/a.codex -> ~/bob/alice.ska. Without a codex, use the path as-is.
-    std::string file_path = codex ? codex->resolve_path(path) : path;
-    std::optional<std::string> source =
-        reader_ ? reader_(file_path) : default_source_reader(file_path);
-    if (!source) {
-      return ParseResult::fail("File not found: " + file_path);
+    if (is_compiled_module(source)) {
+      // Already parsed and linked; only the Program is rebuilt
+      auto module = std::make_shared<Module>();
+      module->filename = path;
+      if (auto why = decode_module(source, *module, codex.get())) {
+        return {ParseResult::fail("Couldn't load compiled module " +
+                                  file_path + ": " + *why),
+                nullptr};
+      }
+      module->codex = std::move(codex);
+      module->program = compile_module(*module);
+      return {ParseResult::with({}), std::move(module)};
+    }
+
+    if (lazy_blocks) {
+      // Blocks are parsed (and linked) as the engine enters them
+      auto module = std::make_shared<Module>();
+      module->filename = path;
+      auto errors = index_module(source, file_path, codex.get(), *module);
+      if (!errors) {
+        return {ParseResult::fail("Module parse failed!"), nullptr};
+      }
+      module->codex = std::move(codex);
+      module->source_hash = hash_source(source);
+      return {ParseResult::with(std::move(*errors)), std::move(module)};
     }
-    pegtl::memory_input in(*source, file_path);
+
+    pegtl::memory_input in(source.data(), source.size(), file_path);
     dbg_out("Loaded file: " << file_path);
 
     /// PARSING ///
@@ -1085,18 +1504,290 @@ ParseResult Engine::load(std::string path) {
       pstate.do_dbg_desc();
     } else {
       dbg_out("Parse failed!");
-      return ParseResult::fail("Module parse failed!");
+      return {ParseResult::fail("Module parse failed!"), nullptr};
     }
 
-    // Grab the finished module from the parse state
-    current = std::make_unique<Module>(std::move(pstate.module));
-    return ParseResult::with(pstate.errors);
+    // Link moves to their blocks, then grab the finished module from the parse
+    // state and compile it in place. It's frozen from here on.
+    auto link_errors = link_module(pstate.module);
+    pstate.errors.insert(pstate.errors.end(), link_errors.begin(),
+                         link_errors.end());
+    auto module = std::make_shared<Module>(std::move(pstate.module));
+    module->codex = std::move(codex);
+    module->source_hash = hash_source(source);
+    module->program = compile_module(*module);
+    return {ParseResult::with(pstate.errors), std::move(module)};
   } catch (const pegtl::parse_error &e) {
     dbg_out("Parse error: " << e.what());
-    return ParseResult::fail(e.what());
+    return {ParseResult::fail(e.what()), nullptr};
   } catch (const std::exception &e) {
     dbg_out("Error: " << e.what());
-    return ParseResult::fail(e.what());
+    return {ParseResult::fail(e.what()), nullptr};
+  }
+}
+
+/** Resolves project paths against the codex root: "alice.ska" with codex
+ *  ~/bob/a.codex -> ~/bob/alice.ska. Without a codex, the path is as-is. */
+static std::string module_file_path(const std::string &path,
+                                    const Codex *codex) {
+  return codex ? codex->resolve_path(path) : path;
+}
+
+Loaded<Module> load_module(const std::string &path,
+                           std::shared_ptr<const Codex> codex,
+                           const SourceReader &reader, bool lazy_blocks) {
+  return load_module(path, std::move(codex), view_reader(reader),
+                     lazy_blocks);
+}
+
+Loaded<Module> load_module(const std::string &path,
+                           std::shared_ptr<const Codex> codex,
+                           const SourceViewReader &reader, bool lazy_blocks) {
+  std::string file_path = module_file_path(path, codex.get());
+  std::optional<SourceView> source = read_source(file_path, reader);
+  if (!source) {
+    return {ParseResult::fail("File not found: " + file_path), nullptr};
+  }
+  return parse_module(path, file_path, source->bytes, std::move(codex),
+                      lazy_blocks);
+}
+
+// SECTION: MODULE CACHE
+
+/** Rough heap size of a loaded module, for the cache's budget: the tree
+ *  holds about as much text as the source, plus a node per instruction. */
+static size_t approx_module_bytes(const Module &module, size_t source_size) {
+  auto &program = module.program;
+  return sizeof(Module) + source_size +
+         program.code.size() * (sizeof(Instruction) + sizeof(MainBlockMember)) +
+         program.queries.size() * sizeof(const MethodCall *) +
+         program.choice_targets.size() * sizeof(uint32_t);
+}
+
+ModuleCache::ModuleCache(size_t max_bytes) : max_bytes(max_bytes) {}
+
+std::shared_ptr<ModuleCache> ModuleCache::shared() {
+  static auto cache = std::make_shared<ModuleCache>();
+  return cache;
+}
+
+std::optional<ModuleCache::FileStamp>
+ModuleCache::stamp_of(const std::string &file_path) {
+  std::error_code ec;
+  auto mtime = std::filesystem::last_write_time(file_path, ec);
+  if (ec) {
+    return std::nullopt;
+  }
+  auto size = std::filesystem::file_size(file_path, ec);
+  if (ec) {
+    return std::nullopt;
+  }
+  return FileStamp{.mtime = mtime, .size = size};
+}
+
+Loaded<Module> ModuleCache::load(const std::string &path,
+                                 std::shared_ptr<const Codex> codex,
+                                 const SourceReader &reader,
+                                 bool lazy_blocks) {
+  return load(path, std::move(codex), view_reader(reader), lazy_blocks);
+}
+
+Loaded<Module> ModuleCache::load(const std::string &path,
+                                 std::shared_ptr<const Codex> codex,
+                                 const SourceViewReader &reader,
+                                 bool lazy_blocks) {
+  std::string file_path = module_file_path(path, codex.get());
+
+  // Only the filesystem can be asked whether a file changed without reading
+  // it. Stamped before reading, so an edit racing the read is caught next
+  // time.
+  std::optional<FileStamp> stamp;
+  if (!reader) {
+    stamp = stamp_of(file_path);
+  }
+  if (stamp) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (auto *hit = find(file_path, codex, lazy_blocks, stamp, std::nullopt))
+      return {hit->result, hit->module};
+  }
+
+  std::optional<SourceView> source = read_source(file_path, reader);
+  if (!source) {
+    return {ParseResult::fail("File not found: " + file_path), nullptr};
+  }
+  uint64_t hash = hash_source(source->bytes);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (auto *hit = find(file_path, codex, lazy_blocks, stamp, hash))
+      return {hit->result, hit->module};
+  }
+
+  // Parse outside the lock so other engines aren't held up by it
+  auto loaded = parse_module(path, file_path, source->bytes, std::move(codex),
+                             lazy_blocks);
+  size_t bytes = loaded.value
+                     ? approx_module_bytes(*loaded.value, source->bytes.size())
+                     : 0;
+  if (!loaded.value || bytes > max_bytes) {
+    return loaded;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = lookup.find(file_path);
+  if (it != lookup.end()) {
+    // Someone else parsed it in the meantime; keep the newest
+    total_bytes -= it->second->bytes;
+    entries.erase(it->second);
+    lookup.erase(it);
+  }
+  entries.push_front(
+      Entry{.file_path = file_path,
+            .hash = hash,
+            .stamp = stamp,
+            .lazy_blocks = lazy_blocks,
+            .bytes = bytes,
+            .result = loaded.result,
+            .module = loaded.value});
+  lookup[file_path] = entries.begin();
+  total_bytes += bytes;
+  evict();
+  return loaded;
+}
+
+ModuleCache::Entry *ModuleCache::find(const std::string &file_path,
+                                      const std::shared_ptr<const Codex> &codex,
+                                      bool lazy_blocks,
+                                      const std::optional<FileStamp> &stamp,
+                                      std::optional<uint64_t> hash) {
+  auto it = lookup.find(file_path);
+  if (it == lookup.end()) {
+    return nullptr;
+  }
+  auto entry = it->second;
+  bool same_file = (stamp && entry->stamp && *entry->stamp == *stamp) ||
+                   (hash && entry->hash == *hash);
+  if (same_file && entry->module->codex == codex &&
+      entry->lazy_blocks == lazy_blocks) {
+    // Hit: move it to the front and share the compiled module. A file
+    // touched but not changed gets its new stamp.
+    if (stamp)
+      entry->stamp = stamp;
+    entries.splice(entries.begin(), entries, entry);
+    return &*entry;
+  }
+  if (hash) {
+    // Stale (edited, compiled against another codex, or the other mode)
+    total_bytes -= entry->bytes;
+    entries.erase(entry);
+    lookup.erase(it);
+  }
+  return nullptr;
+}
+
+void ModuleCache::set_max_bytes(size_t new_max_bytes) {
+  std::lock_guard<std::mutex> lock(mutex);
+  max_bytes = new_max_bytes;
+  evict();
+}
+
+size_t ModuleCache::size() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return entries.size();
+}
+
+size_t ModuleCache::bytes() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return total_bytes;
+}
+
+void ModuleCache::clear() {
+  std::lock_guard<std::mutex> lock(mutex);
+  entries.clear();
+  lookup.clear();
+  total_bytes = 0;
+}
+
+/** Drops least recently used entries past the budget. Expects the lock
+ *  held. */
+void ModuleCache::evict() {
+  while (total_bytes > max_bytes) {
+    total_bytes -= entries.back().bytes;
+    lookup.erase(entries.back().file_path);
+    entries.pop_back();
+  }
+}
+
+ParseResult Engine::setup(std::string path) {
+  auto loaded = load_codex(path, reader_);
+  if (loaded.value) {
+    setup(std::move(loaded.value));
+  }
+  return loaded.result;
+}
+
+void Engine::setup(std::shared_ptr<const Codex> shared_codex) {
+  codex = std::move(shared_codex);
+
+  // A module's slots and method indices only hold for the codex it was
+  // loaded against, so one loaded against another has to be loaded again.
+  if (current && current->codex != codex) {
+    current = nullptr;
+    segment = nullptr;
+    cursor.reset();
+  }
+
+  // Initialize state with the new codex (wipes prior state and bindings)
+  native_methods.replace({});
+  init_state();
+}
+
+ParseResult Engine::load(std::string path) {
+  auto loaded = module_cache
+                    ? module_cache->load(path, codex, reader_, lazy_blocks)
+                    : load_module(path, codex, reader_, lazy_blocks);
+  if (loaded.value) {
+    current = std::move(loaded.value);
+    segment = nullptr;
+    if (prefetch) {
+      // Cancels whatever the last module queued and hasn't started yet
+      prefetch_owner = std::make_shared<const bool>(true);
+      prefetch_go_targets(current->program);
+    }
+  }
+  return loaded.result;
+}
+
+ParseResult Engine::load(std::shared_ptr<const Module> module) {
+  if (!module) {
+    return ParseResult::fail("No module to load");
+  }
+  if (module->codex != codex) {
+    return ParseResult::fail("Module " + module->filename +
+                             " was loaded against a different codex");
+  }
+  current = std::move(module);
+  segment = nullptr;
+  return ParseResult::with({});
+}
+
+void Engine::prefetch_go_targets(const Program &program) {
+  if (!module_cache || !prefetch_owner) {
+    return;
+  }
+
+  std::unordered_set<std::string_view> queued;
+  for (auto &ins : program.code) {
+    if (ins.op != Instruction::GO || !queued.insert(ins.go->module_path).second)
+      continue;
+    const std::string &path = ins.go->module_path;
+    dbg_out("Prefetching module: " << path);
+    // Everything is captured by value: the engine may move on (or go away)
+    // before the load runs.
+    PrefetchPool::shared().submit(
+        prefetch_owner, [cache = module_cache, codex = codex, reader = reader_,
+                         lazy = lazy_blocks, path] {
+          cache->load(path, codex, reader, lazy);
+        });
   }
 }
 
@@ -1120,35 +1811,133 @@ std::optional<std::string> Engine::get_codex_name() {
   return std::nullopt;
 }
 
+/// NATIVE METHODS ///
+
+std::optional<Error>
+Engine::bind_native(const std::string &name,
+                    const std::vector<ValueType> &arg_types,
+                    ValueType return_type, NativeMethod fn) {
+  if (!codex) {
+    return Error(ERROR_BAD_BINDING,
+                 "Tried to bind " + name + ", but no codex is set up.", 0);
+  }
+  int index = codex->get_method_index(name);
+  if (index < 0) {
+    return Error(ERROR_BAD_BINDING,
+                 "Tried to bind " + name +
+                     ", but the codex has no such method.",
+                 0);
+  }
+  auto &def = codex->method_defs[index];
+  if (def.return_type != return_type) {
+    return Error(ERROR_BAD_BINDING,
+                 "Method " + name + " returns " +
+                     val_type_to_str(def.return_type) +
+                     " in the codex, but its binding returns " +
+                     val_type_to_str(return_type) + ".",
+                 def.line_number);
+  }
+  if (def.args.size() != arg_types.size()) {
+    return Error(ERROR_BAD_BINDING,
+                 "Method " + name + " has " + std::to_string(def.args.size()) +
+                     " arguments in the codex, but its binding takes " +
+                     std::to_string(arg_types.size()) + ".",
+                 def.line_number);
+  }
+  for (size_t i = 0; i < arg_types.size(); i++) {
+    if (def.args[i].type != arg_types[i]) {
+      return Error(ERROR_BAD_BINDING,
+                   "Argument " + def.args[i].name + " of " + name + " is " +
+                       val_type_to_str(def.args[i].type) +
+                       " in the codex, but its binding takes " +
+                       val_type_to_str(arg_types[i]) + ".",
+                   def.line_number);
+    }
+  }
+  auto &natives = native_methods.write();
+  natives.resize(codex->method_defs.size());
+  natives[index] = std::move(fn);
+  return std::nullopt;
+}
+
+const NativeMethod *Engine::native_for(const MethodCall &call) const {
+  auto &natives = *native_methods;
+  if (call.method_index < 0 ||
+      static_cast<size_t>(call.method_index) >= natives.size() ||
+      !natives[call.method_index]) {
+    return nullptr;
+  }
+  return &natives[call.method_index];
+}
+
+std::optional<SimpleRValue> Engine::call_native(const NativeMethod &native,
+                                                const MethodCall &call) {
+  auto &def = codex->method_defs[call.method_index];
+  if (call.args.size() != def.args.size()) {
+    warn("Call to " + call.method + " has the wrong number of arguments; " +
+             "not calling it.",
+         call.line_number);
+    return std::nullopt;
+  }
+  std::vector<SimpleRValue> args;
+  args.reserve(call.args.size());
+  for (size_t i = 0; i < call.args.size(); i++) {
+    args.push_back(resolve_rval_to_simple(call.args[i]));
+    if (srval_get_type(args.back()) != def.args[i].type) {
+      warn("Argument " + def.args[i].name + " of " + call.method +
+               " resolved to " + rval_to_string(args.back()) +
+               ", which isn't " + val_type_to_str(def.args[i].type) +
+               "; not calling it.",
+           call.line_number);
+      return std::nullopt;
+    }
+  }
+  return native(args);
+}
+
+std::optional<SimpleRValue> Engine::native_answer(const NativeMethod &native,
+                                                  const MethodCall &call) {
+  for (auto &[done, val] : cursor.native_results) {
+    if (done == &call)
+      return val;
+  }
+  auto val = call_native(native, call);
+  cursor.native_results.emplace_back(&call, val);
+  return val;
+}
+
 /// EXTERNAL STATE ACCESS ///
 
+void Engine::set_cache_policy(CachePolicy policy) { cache_policy = policy; }
+
 /** Sets global state; errors if global doesn't exist or type mismatch. */
 std::optional<Error> Engine::set(std::string key, SimpleRValue val) {
-  auto it = global_state.find(key);
-  if (it == global_state.end()) {
+  int slot = codex ? codex->get_global_slot(key) : -1;
+  if (slot < 0) {
     return Error(ERROR_VAR_UNDEFINED,
                  "Tried to set undefined global var " + key + ".", 0);
   }
 
-  if (srval_get_type(it->second) != srval_get_type(val)) {
+  if (srval_get_type((*global_state)[slot]) != srval_get_type(val)) {
     return Error(ERROR_TYPE_MISMATCH,
                  "Tried to set global var " + key + " to " +
                      rval_to_string(val) + ", but the type does not match.",
                  0);
   }
 
-  it->second = val;
+  global_state.write()[slot] = val;
+  dirty_globals.mark(slot);
   return std::nullopt;
 }
 
 /** Returns state; errors if not set. */
 std::variant<Error, SimpleRValue> Engine::get(std::string key) {
-  auto it = global_state.find(key);
-  if (it == global_state.end()) {
+  int slot = codex ? codex->get_global_slot(key) : -1;
+  if (slot < 0) {
     return Error(ERROR_VAR_UNDEFINED,
                  "Tried to get undefined global var " + key + ".", 0);
   }
-  return it->second;
+  return (*global_state)[slot];
 }
 
 } // namespace Skald
@@ -275,7 +275,7 @@ template <> struct action<val_string> {
 template <> struct action<r_variable> {
   template <typename ActionInput>
   static void apply(const ActionInput &input, ParseState &state) {
-    state.rval_buffer.push_back(Variable{input.string()});
+    state.rval_buffer.push_back(state.resolve_var(input.string()));
   }
 };
 template <> struct action<r_method> {
@@ -283,6 +283,7 @@ template <> struct action<r_method> {
   static void apply(const ActionInput &input, ParseState &state) {
     auto method_call = std::make_shared<MethodCall>(MethodCall{
         .method = state.pop_id(), .args = std::move(state.argument_queue)});
+    state.prepare_call(*method_call);
     state.validate_method(*method_call, input.position());
     state.rval_buffer.push_back(method_call);
   }
@@ -587,6 +588,7 @@ template <> struct action<op_method> {
   static void apply(const ActionInput &input, ParseState &state) {
     auto mc = MethodCall{input.position().line, state.pop_id(),
                          std::move(state.argument_queue)};
+    state.prepare_call(mc);
     state.validate_method(mc, input.position());
     state.member_body_buffer = std::move(mc);
     dbg_out(">>> op_method: " << input.string());
@@ -600,16 +602,17 @@ template <> struct action<op_mutate_subtract> {
   static void apply(const ActionInput &input, ParseState &state) {
     dbg_out(">>> op_mutate_subtract: " << input.string());
     state.member_body_buffer =
-        Mutation{input.position().line, state.pop_id(), Mutation::SUBTRACT,
-                 state.rval_buffer_pop()};
+        Mutation{input.position().line, state.resolve_var(state.pop_id()),
+                 Mutation::SUBTRACT, state.rval_buffer_pop()};
   }
 };
 template <> struct action<op_mutate_add> {
   template <typename ActionInput>
   static void apply(const ActionInput &input, ParseState &state) {
     dbg_out(">>> op_mutate_add: " << input.string());
-    state.member_body_buffer = Mutation{input.position().line, state.pop_id(),
-                                        Mutation::ADD, state.rval_buffer_pop()};
+    state.member_body_buffer =
+        Mutation{input.position().line, state.resolve_var(state.pop_id()),
+                 Mutation::ADD, state.rval_buffer_pop()};
   }
 };
 template <> struct action<op_mutate_equate> {
@@ -617,15 +620,16 @@ template <> struct action<op_mutate_equate> {
   static void apply(const ActionInput &input, ParseState &state) {
     dbg_out(">>> op_mutate_equate: " << input.string());
     state.member_body_buffer =
-        Mutation{input.position().line, state.pop_id(), Mutation::EQUATE,
-                 state.rval_buffer_pop()};
+        Mutation{input.position().line, state.resolve_var(state.pop_id()),
+                 Mutation::EQUATE, state.rval_buffer_pop()};
   }
 };
 template <> struct action<op_mutate_switch> {
   template <typename ActionInput>
   static void apply(const ActionInput &input, ParseState &state) {
     state.member_body_buffer =
-        Mutation{input.position().line, state.pop_id(), Mutation::SWITCH, {}};
+        Mutation{input.position().line, state.resolve_var(state.pop_id()),
+                 Mutation::SWITCH, {}};
   }
 };
 
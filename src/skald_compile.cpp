@@ -0,0 +1,238 @@
+/** skald_compile: compiles a project ahead of time into what a game ships,
+ *  either a directory of compiled files or a single .skpak. Modules are
+ *  compiled in parallel, and one whose source and codex haven't changed
+ *  since the last build is copied over instead of compiled again. */
+#include "binary_io.h"
+#include "debug.h"
+#include "module_binary.h"
+#include "skald.h"
+#include "skalder_fs.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+using namespace Skald;
+
+/** Where output goes when neither --out nor --pack is given. Hidden, so
+ *  find_modules doesn't mistake the compiled files for sources. */
+static const char *DEFAULT_OUT_DIR = ".skald_build";
+
+static void usage() {
+  std::cerr << "usage: skald_compile [--out DIR | --pack FILE] [--jobs N] "
+               "[--force] [path]\n"
+               "  path    any file or directory in the project (default .)\n"
+               "  --out   write compiled files under DIR (default "
+            << DEFAULT_OUT_DIR
+            << " in the project root)\n"
+               "  --pack  write a single .skpak instead\n"
+               "  --jobs  modules compiled at once (default: hardware "
+               "threads)\n"
+               "  --force compile every module, even unchanged ones\n";
+}
+
+static bool write_file(const fs::path &path, const std::string &bytes) {
+  std::error_code ec;
+  if (path.has_parent_path())
+    fs::create_directories(path.parent_path(), ec);
+  std::ofstream f(path, std::ios::binary | std::ios::trunc);
+  f.write(bytes.data(), bytes.size());
+  return static_cast<bool>(f);
+}
+
+static void print_errors(const std::string &path, const ParseResult &result) {
+  for (auto &ex : result.exceptions) {
+    std::cerr << path;
+    if (ex.pos.line)
+      std::cerr << ":" << ex.pos.line;
+    std::cerr << (ex.severity == ParseError::ERROR ? ": error: "
+                                                   : ": warning: ")
+              << ex.msg << "\n";
+  }
+}
+
+/** One module's trip through the build */
+struct Job {
+  std::string path; // Relative to the project root, as GO paths are
+  std::string compiled;
+  bool reused = false;
+  bool ok = false;
+};
+
+int main(int argc, char **argv) {
+  // Library chatter would drown out the errors we actually report
+  Skald::log_level = Skald::SkaldLogLevel::OFF;
+  dbg_out_on = false;
+  dbg_always_cout = false;
+  dbg_sink = [](const std::string &) {};
+
+  std::string out_dir, pack_path, start = ".";
+  size_t jobs = std::max(1u, std::thread::hardware_concurrency());
+  bool force = false;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--out" && i + 1 < argc) {
+      out_dir = argv[++i];
+    } else if (arg == "--pack" && i + 1 < argc) {
+      pack_path = argv[++i];
+    } else if (arg == "--jobs" && i + 1 < argc) {
+      jobs = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+    } else if (arg == "--force") {
+      force = true;
+    } else if (arg.rfind("--", 0) == 0 || i != argc - 1) {
+      usage();
+      return 1;
+    } else {
+      start = arg;
+    }
+  }
+  if (!out_dir.empty() && !pack_path.empty()) {
+    usage();
+    return 1;
+  }
+
+  // SECTION: PROJECT
+
+  FileManager files;
+  auto root = files.find_project_root(start);
+  if (auto *err = std::get_if<FileManager::FileError>(&root)) {
+    std::cerr << err->msg << "\n";
+    return 1;
+  }
+  if (std::holds_alternative<FileManager::NoOp>(root)) {
+    std::cerr << "No .codex file found in or above " << start << "\n";
+    return 1;
+  }
+  const std::string codex_path = std::get<std::string>(root);
+  auto loaded_codex = load_codex(codex_path);
+  print_errors(codex_path, loaded_codex.result);
+  if (!loaded_codex.result.ok) {
+    return 1;
+  }
+  auto codex = loaded_codex.value;
+  const std::string codex_name = codex->filename;
+  if (out_dir.empty() && pack_path.empty()) {
+    out_dir = (fs::path(codex->path) / DEFAULT_OUT_DIR).string();
+  }
+
+  // The previous build, for skipping unchanged modules
+  std::optional<SourceViewReader> previous;
+  if (!force) {
+    if (!pack_path.empty()) {
+      if (fs::exists(pack_path))
+        previous = pack_source_reader(pack_path);
+    } else {
+      previous = SourceViewReader([&](const std::string &path) {
+        return mapped_source_reader((fs::path(out_dir) / path).string());
+      });
+    }
+  }
+
+  // SECTION: BUILD
+
+  std::vector<Job> queue;
+  for (auto &path : files.find_modules(codex->path)) {
+    queue.push_back(Job{.path = path});
+  }
+
+  std::atomic<size_t> next{0};
+  std::mutex print_mutex;
+  auto work = [&] {
+    while (true) {
+      size_t i = next++;
+      if (i >= queue.size())
+        return;
+      Job &job = queue[i];
+      auto file_path = codex->resolve_path(job.path);
+      auto source = mapped_source_reader(file_path);
+      if (!source) {
+        std::lock_guard<std::mutex> lock(print_mutex);
+        std::cerr << job.path << ": error: couldn't read it\n";
+        continue;
+      }
+      if (is_compiled_module(source->bytes)) {
+        // Our own output, if --out points inside the project; not a source
+        job.ok = true;
+        continue;
+      }
+      if (previous) {
+        auto old = (*previous)(job.path);
+        uint64_t hash = fnv1a(source->bytes.data(), source->bytes.size());
+        if (old && compiled_is_current(old->bytes, hash, codex.get())) {
+          job.compiled = std::string(old->bytes);
+          job.ok = job.reused = true;
+          continue;
+        }
+      }
+      auto loaded = load_module(
+          job.path, codex,
+          [&](const std::string &) { return source; });
+      if (!loaded.result.exceptions.empty()) {
+        std::lock_guard<std::mutex> lock(print_mutex);
+        print_errors(job.path, loaded.result);
+      }
+      if (loaded.value && loaded.result.ok) {
+        job.compiled = save_compiled(*loaded.value);
+        job.ok = true;
+      }
+    }
+  };
+  std::vector<std::thread> pool;
+  for (size_t i = 1; i < std::min(jobs, queue.size()); i++) {
+    pool.emplace_back(work);
+  }
+  work();
+  for (auto &t : pool) {
+    t.join();
+  }
+
+  // SECTION: OUTPUT
+
+  size_t compiled = 0, reused = 0, failed = 0;
+  std::vector<std::pair<std::string, std::string>> pack_files;
+  pack_files.emplace_back(codex_name, save_compiled(*codex));
+  for (auto &job : queue) {
+    if (!job.ok) {
+      failed++;
+      continue;
+    }
+    if (job.compiled.empty())
+      continue;
+    job.reused ? reused++ : compiled++;
+    if (!pack_path.empty()) {
+      pack_files.emplace_back(job.path, std::move(job.compiled));
+    } else if (!job.reused &&
+               !write_file(fs::path(out_dir) / job.path, job.compiled)) {
+      std::cerr << job.path << ": error: couldn't write it to " << out_dir
+                << "\n";
+      failed++;
+    }
+  }
+  if (failed && !pack_path.empty()) {
+    // A pack missing modules would only fail later, on a GO
+    std::cerr << failed << " module(s) failed; pack not written.\n";
+    return 1;
+  }
+
+  previous.reset(); // It may be mapping the pack we're about to replace
+  bool written = pack_path.empty()
+                     ? write_file(fs::path(out_dir) / codex_name,
+                                  pack_files.front().second)
+                     : write_file(pack_path, save_pack(pack_files));
+  if (!written) {
+    std::cerr << "Couldn't write " << (pack_path.empty() ? out_dir : pack_path)
+              << "\n";
+    return 1;
+  }
+  std::cout << compiled << " compiled, " << reused << " unchanged, " << failed
+            << " failed -> " << (pack_path.empty() ? out_dir : pack_path)
+            << "\n";
+  return failed ? 1 : 0;
+}
@@ -275,11 +275,12 @@ struct cond_chain : seq<cond_chain_if_block, star<cond_chain_elseif_block>,
 struct malformed_line : seq<not_at<block_tag_line>, not_at<eolf>, until<eolf>> {
 };
 
-/** A `block` starts with a tag line, then has beats, comments/blank,
- * operations, choice blocks until the next block starts. */
-struct block
-    : seq<block_tag_line,
-          star<sor<cond_chain, block_member, malformed_line>>> {};
+/** Everything in a block after its tag line: beats, comments/blank,
+ *  operations, choice blocks until the next block starts. */
+struct block_body : star<sor<cond_chain, block_member, malformed_line>> {};
+
+/** A `block` starts with a tag line, then has its body. */
+struct block : seq<block_tag_line, block_body> {};
 
 // SECTION: FULL GRAMMAR
 
@@ -289,4 +290,21 @@ struct grammar : seq<star<ignored>, // Skip initial comments/blanks
                      opt<eof>       // Optional EOF (more forgiving)
                      > {};
 
+// SECTION: LAZY LOADING
+
+/** A line of a block body, skipped over unparsed: anything up to the next
+ *  tag line. */
+struct skipped_line : seq<not_at<block_tag_line>, not_at<eof>, until<eolf>> {
+};
+struct skipped_block : seq<block_tag_line, star<skipped_line>> {};
+
+/** A lazily loaded module (see load_module): top matter is parsed as usual,
+ *  but only block tag lines are, so blocks are indexed without their bodies.
+ *  Each body is parsed later from just past its tag line with
+ *  lazy_block_body; a tag line that didn't start a block (it's an error) is
+ *  part of the body before it, as it is in a full parse. */
+struct block_index
+    : seq<star<ignored>, top_matter, plus<skipped_block>, opt<eof>> {};
+struct lazy_block_body : seq<block_body, star<block>> {};
+
 } // namespace Skald
@@ -303,6 +303,8 @@ int main(int argc, char *argv[]) {
   if (!res.ok) {
     return 0;
   }
+  // Keep about a megabyte of steps around for F9 to rewind through
+  tester.engine.set_rewind_limit(1 << 20);
   tester.note_system("STARTING MODULE: " + module_path);
   dbg_log("STARTING MODULE: " + module_path);
 
@@ -461,6 +463,17 @@ int main(int argc, char *argv[]) {
       show_logs = !show_logs;
       return true;
     }
+    if (event == Event::F9) {
+      auto back = tester.engine.rewind(1);
+      if (auto *err = std::get_if<Error>(&back)) {
+        dbg_log(err->message, LogSeverity::WARN);
+        return true;
+      }
+      tester.note_system("Rewound one step.");
+      response = back;
+      do_next();
+      return true;
+    }
     switch (tester.expected_input) {
     case SkaldTester::CONTINUE: {
       if (event == Event::Character(' ') || event == Event::Character('n')) {
@@ -1,5 +1,6 @@
 /** Filesystem helpers for Skalder (codex discovery, module listing). Only
- *  used by the skalder binary -- never consumed in library mode. */
+ *  used by the skalder and skald_compile binaries -- never consumed in
+ *  library mode. */
 #pragma once
 
 #include "debug.h"
@@ -0,0 +1,687 @@
+#include "binary_io.h"
+#include "debug.h"
+#include "lazy_module.h"
+#include "skald.h"
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <variant>
+#include <vector>
+
+namespace Skald {
+
+// SECTION: ENCODING
+
+/** Bumped whenever the layout below changes; restore refuses other versions.
+ *
+ *  Layout (little-endian; strings are a u32 length then bytes; values are a
+ *  u8 type in ValueType order, then a string, u8 bool, i32 or f32):
+ *   - "SKBM", u16 version
+ *   - module path (empty if none), u64 module source hash
+ *   - u8 loaded lazily, then (if so) u32 block whose segment holds the pc,
+ *     or NO_TARGET before the module has been entered
+ *   - u32 pc, u8 flags (GO/EXIT queued), u32 next ticket, u64 step,
+ *     u64 block visit
+ *   - pending queries: u32 count, then u32 query index + u32 ticket each
+ *   - answered calls: u32 count, then u32 query index each
+ *   - globals by slot: u32 count, values
+ *   - module vars by index: u32 count, then name + value each
+ *   - locals: u32 count, then name + value each (set ones only)
+ *   - query cache: u32 count, then key text, u8 has value, value (if any),
+ *     u64 step, u64 block visit each
+ *  Query indices point into the Program the pc is in. Locals go by name,
+ *  since a lazily loaded module hands out their slots as blocks get parsed. */
+static constexpr uint16_t SNAPSHOT_VERSION = 3;
+static constexpr char SNAPSHOT_MAGIC[4] = {'S', 'K', 'B', 'M'};
+
+/** Deltas share the encodings above. Layout:
+ *   - "SKBD", u16 version
+ *   - base: u64 step, u64 block visit, u32 next ticket at the checkpoint
+ *   - module and cursor, as in a snapshot
+ *   - written globals: u32 count, then u32 slot + value each
+ *   - written module vars: u32 count, then u32 index + name + value each
+ *   - locals, all the set ones, as in a snapshot
+ *   - new or changed query cache entries, as in a snapshot */
+static constexpr uint16_t DELTA_VERSION = 3;
+static constexpr char DELTA_MAGIC[4] = {'S', 'K', 'B', 'D'};
+
+static constexpr uint8_t FLAG_QUEUED_GO = 1;
+static constexpr uint8_t FLAG_QUEUED_EXIT = 2;
+
+namespace {
+
+/** A saved module identity and cursor, as read back. Pointers into the
+ *  module are still indices; fits() checks them before apply_cursor() turns
+ *  them back into pointers. */
+struct SavedCursor {
+  std::string module_path;
+  uint64_t source_hash = 0;
+  bool lazy = false;
+  uint32_t block = Instruction::NO_TARGET;
+  uint32_t pc = 0;
+  uint8_t flags = 0;
+  uint32_t next_ticket = 0;
+  uint64_t step = 0;
+  uint64_t block_visit = 0;
+  std::vector<std::pair<uint32_t, uint32_t>> pending; // query index, ticket
+  std::vector<uint32_t> answered;                     // query indices
+};
+
+/** program is the one the pc is in (if there's a module); segment is the
+ *  current block's, for a lazily loaded module. */
+void write_cursor(Writer &w, const Module *module, const ParsedBlock *segment,
+                  const Program *program, const Cursor &cursor,
+                  uint32_t next_ticket, uint64_t step, uint64_t block_visit) {
+  w.str(module ? module->filename : "");
+  w.num<uint64_t>(module ? module->source_hash : 0);
+  w.num<uint8_t>(module && module->lazy);
+  if (module && module->lazy) {
+    w.num<uint32_t>(segment ? segment->index : Instruction::NO_TARGET);
+  }
+
+  w.num<uint32_t>(cursor.pc);
+  w.num<uint8_t>((cursor.queued_go ? FLAG_QUEUED_GO : 0) |
+                 (cursor.queued_exit ? FLAG_QUEUED_EXIT : 0));
+  w.num<uint32_t>(next_ticket);
+  w.num<uint64_t>(step);
+  w.num<uint64_t>(block_visit);
+
+  // Pending and answered calls are always from the current instruction's
+  // manifest, so they're saved as indices into Program::queries.
+  auto query_index = [&](const MethodCall *call) -> uint32_t {
+    auto &ins = program->code[cursor.pc];
+    for (uint32_t i = ins.query_begin; i < ins.query_begin + ins.query_count;
+         i++) {
+      if (program->queries[i] == call)
+        return i;
+    }
+    assert(false); // compiler must list every condition call in the manifest
+    return 0;
+  };
+  w.num<uint32_t>(cursor.resolution_stack.size());
+  for (auto &pending : cursor.resolution_stack) {
+    w.num<uint32_t>(query_index(pending.call));
+    w.num<uint32_t>(pending.ticket);
+  }
+  w.num<uint32_t>(cursor.answered.size());
+  for (auto *call : cursor.answered) {
+    w.num<uint32_t>(query_index(call));
+  }
+}
+
+SavedCursor read_cursor(Reader &r) {
+  SavedCursor c;
+  c.module_path = r.str();
+  c.source_hash = r.num<uint64_t>();
+  c.lazy = r.num<uint8_t>() != 0;
+  if (c.lazy) {
+    c.block = r.num<uint32_t>();
+  }
+  c.pc = r.num<uint32_t>();
+  c.flags = r.num<uint8_t>();
+  c.next_ticket = r.num<uint32_t>();
+  c.step = r.num<uint64_t>();
+  c.block_visit = r.num<uint64_t>();
+  c.pending.resize(r.count(8));
+  for (auto &[index, ticket] : c.pending) {
+    index = r.num<uint32_t>();
+    ticket = r.num<uint32_t>();
+  }
+  c.answered.resize(r.count(4));
+  for (auto &index : c.answered) {
+    index = r.num<uint32_t>();
+  }
+  return c;
+}
+
+/** True if the saved cursor can be applied to program, the one its pc is in.
+ *  A lazily loaded module that hasn't been entered yet has none. */
+bool fits(const SavedCursor &c, const Program *program) {
+  if (!program) {
+    return c.pc == 0 && c.flags == 0 && c.pending.empty() &&
+           c.answered.empty();
+  }
+  if (c.pc >= program->code.size()) {
+    return false;
+  }
+  auto &ins = program->code[c.pc];
+  auto in_manifest = [&](uint32_t index) {
+    return index >= ins.query_begin &&
+           index < ins.query_begin + ins.query_count;
+  };
+  for (auto &[index, ticket] : c.pending) {
+    if (!in_manifest(index))
+      return false;
+  }
+  for (auto index : c.answered) {
+    if (!in_manifest(index))
+      return false;
+  }
+  return !((c.flags & FLAG_QUEUED_GO) && ins.op != Instruction::GO) &&
+         !((c.flags & FLAG_QUEUED_EXIT) && ins.op != Instruction::EXIT);
+}
+
+void apply_cursor(const SavedCursor &c, const Program &program,
+                  Cursor &cursor) {
+  cursor.reset();
+  cursor.pc = c.pc;
+  if (program.code.empty()) {
+    return;
+  }
+  auto &ins = program.code[c.pc];
+  if (c.flags & FLAG_QUEUED_GO)
+    cursor.queued_go = ins.go;
+  if (c.flags & FLAG_QUEUED_EXIT)
+    cursor.queued_exit = ins.exit;
+  for (auto &[index, ticket] : c.pending) {
+    cursor.resolution_stack.push_back({program.queries[index], ticket});
+  }
+  for (auto index : c.answered) {
+    cursor.answered.push_back(program.queries[index]);
+  }
+}
+
+/** names are the module's locals by slot (see local_names) */
+void write_locals(Writer &w,
+                  const std::vector<std::optional<SimpleRValue>> &locals,
+                  const std::vector<std::string> &names) {
+  size_t set = std::count_if(locals.begin(), locals.end(),
+                             [](auto &val) { return val.has_value(); });
+  w.num<uint32_t>(set);
+  for (size_t i = 0; i < locals.size(); i++) {
+    if (locals[i]) {
+      w.str(names[i]);
+      w.value(*locals[i]);
+    }
+  }
+}
+
+std::vector<std::pair<std::string, SimpleRValue>> read_locals(Reader &r) {
+  std::vector<std::pair<std::string, SimpleRValue>> locals(r.count(6));
+  for (auto &[name, val] : locals) {
+    name = r.str();
+    val = r.value();
+  }
+  return locals;
+}
+
+/** Names of the module's locals, by slot. A lazily loaded module's table
+ *  grows as blocks get parsed, so it's copied. */
+std::vector<std::string> local_names(const Module &module) {
+  return module.lazy ? lazy_local_vars(*module.lazy) : module.local_vars;
+}
+
+/** Slots of the saved locals in module's table, or nullopt if one isn't a
+ *  local of the module. A lazily loaded module may not have parsed the
+ *  block that uses one yet, so it gets a slot up front instead. */
+std::optional<std::vector<uint32_t>>
+local_slots(const std::vector<std::pair<std::string, SimpleRValue>> &locals,
+            const Module &module) {
+  std::vector<uint32_t> slots;
+  for (auto &[name, val] : locals) {
+    if (module.lazy) {
+      slots.push_back(lazy_local_slot(*module.lazy, name));
+      continue;
+    }
+    auto &vars = module.local_vars;
+    auto it = std::find(vars.begin(), vars.end(), name);
+    if (it == vars.end()) {
+      return std::nullopt;
+    }
+    slots.push_back(it - vars.begin());
+  }
+  return slots;
+}
+
+/** The segment a lazily loaded module's saved cursor is in (null if it
+ *  hadn't been entered yet), or why it can't be had */
+std::variant<std::string, std::shared_ptr<const ParsedBlock>>
+saved_segment(const SavedCursor &c, const Module &module) {
+  if (!module.lazy || c.block == Instruction::NO_TARGET) {
+    return std::shared_ptr<const ParsedBlock>();
+  }
+  if (c.block >= module.blocks.size()) {
+    return "it doesn't match module " + c.module_path + ".";
+  }
+  auto parsed = lazy_block(module, c.block);
+  if (!parsed->result.ok) {
+    return "block " + module.blocks[c.block].tag + " of module " +
+           c.module_path + " didn't parse.";
+  }
+  return parsed;
+}
+
+/** Names of module_state entries, by index */
+std::vector<const std::string *>
+module_var_names(const std::unordered_map<std::string, uint32_t> &slots,
+                 size_t count) {
+  std::vector<const std::string *> names(count);
+  for (auto &[name, index] : slots) {
+    names[index] = &name;
+  }
+  return names;
+}
+
+// Query cache entries; templated only because Engine::CachedAnswer is
+// private to the engine.
+
+template <typename Answer>
+void write_answer(Writer &w, const QueryKey &key, const Answer &cached) {
+  w.str(key.text);
+  w.num<uint8_t>(cached.val.has_value());
+  if (cached.val)
+    w.value(*cached.val);
+  w.num<uint64_t>(cached.step);
+  w.num<uint64_t>(cached.block_visit);
+}
+
+template <typename Answer>
+std::pair<QueryKey, Answer> read_answer(Reader &r) {
+  QueryKey key{.text = r.str()};
+  key.hash = std::hash<std::string>{}(key.text);
+  Answer cached;
+  if (r.num<uint8_t>())
+    cached.val = r.value();
+  cached.step = r.num<uint64_t>();
+  cached.block_visit = r.num<uint64_t>();
+  return {std::move(key), std::move(cached)};
+}
+static constexpr size_t MIN_ANSWER_SIZE = 21;
+
+} // namespace
+
+std::variant<std::string, std::shared_ptr<const Module>>
+Engine::saved_module(const std::string &path, uint64_t source_hash,
+                     bool lazy) {
+  if (path.empty()) {
+    return std::shared_ptr<const Module>();
+  }
+  std::shared_ptr<const Module> module = current;
+  if (!module || module->filename != path ||
+      (module->lazy != nullptr) != lazy) {
+    auto loaded = module_cache
+                      ? module_cache->load(path, codex, reader_, lazy)
+                      : load_module(path, codex, reader_, lazy);
+    if (!loaded.value) {
+      return "module " + path + " didn't load.";
+    }
+    module = std::move(loaded.value);
+  }
+  if (module->source_hash != source_hash) {
+    return "module " + path + " has changed since it was saved.";
+  }
+  if (lazy && !module->lazy) {
+    return "module " + path + " was loaded lazily, but is compiled now.";
+  }
+  return module;
+}
+
+// SECTION: SNAPSHOT
+
+std::vector<uint8_t> Engine::snapshot() const {
+  Writer w;
+  w.out.reserve(256);
+  w.out.insert(w.out.end(), SNAPSHOT_MAGIC, SNAPSHOT_MAGIC + 4);
+  w.num<uint16_t>(SNAPSHOT_VERSION);
+
+  write_cursor(w, current.get(), segment.get(), current ? &program() : nullptr,
+               cursor, next_ticket, step, block_visit);
+
+  w.num<uint32_t>(global_state->size());
+  for (auto &val : *global_state) {
+    w.value(val);
+  }
+
+  auto names = module_var_names(*module_slots, module_state->size());
+  w.num<uint32_t>(module_state->size());
+  for (size_t i = 0; i < module_state->size(); i++) {
+    w.str(*names[i]);
+    w.value((*module_state)[i]);
+  }
+
+  write_locals(w, local_state,
+               current ? local_names(*current) : std::vector<std::string>());
+
+  w.num<uint32_t>(query_cache->size());
+  for (auto &[key, cached] : *query_cache) {
+    write_answer(w, key, cached);
+  }
+  return std::move(w.out);
+}
+
+std::optional<Error> Engine::restore(const std::vector<uint8_t> &blob) {
+  auto bad = [](const std::string &why) {
+    return Error(ERROR_BAD_SNAPSHOT, "Can't restore snapshot: " + why, 0);
+  };
+  Reader r(blob);
+  if (auto why = read_header(r, SNAPSHOT_MAGIC, SNAPSHOT_VERSION, "snapshot"))
+    return bad(*why);
+
+  // Read everything into locals first, so a bad blob changes nothing
+  SavedCursor saved = read_cursor(r);
+
+  std::vector<SimpleRValue> globals(r.count(2));
+  for (auto &val : globals) {
+    val = r.value();
+  }
+
+  std::vector<SimpleRValue> module_vals(r.count(6));
+  std::unordered_map<std::string, uint32_t> slots;
+  for (uint32_t i = 0; i < module_vals.size(); i++) {
+    slots[r.str()] = i;
+    module_vals[i] = r.value();
+  }
+
+  auto locals = read_locals(r);
+
+  std::unordered_map<QueryKey, CachedAnswer, QueryKey::Hash> cache;
+  for (uint32_t n = r.count(MIN_ANSWER_SIZE); n > 0 && r.ok; n--) {
+    cache.insert(read_answer<CachedAnswer>(r));
+  }
+
+  if (!r.ok || r.pos != blob.size()) {
+    return bad("it's truncated or corrupt.");
+  }
+
+  /// Check it fits this engine ///
+
+  size_t global_count = codex ? codex->global_vars.size() : 0;
+  if (globals.size() != global_count) {
+    return bad("it has " + std::to_string(globals.size()) +
+               " globals, but the codex has " + std::to_string(global_count) +
+               ".");
+  }
+  for (size_t i = 0; i < globals.size(); i++) {
+    if (globals[i].index() != codex->global_vars[i].initial_value.index()) {
+      return bad("global " + codex->global_vars[i].var.name +
+                 " has a different type in the codex.");
+    }
+  }
+
+  auto found = saved_module(saved.module_path, saved.source_hash, saved.lazy);
+  if (auto *why = std::get_if<std::string>(&found)) {
+    return bad(*why);
+  }
+  auto module = std::get<std::shared_ptr<const Module>>(std::move(found));
+  std::shared_ptr<const ParsedBlock> saved_in;
+  std::vector<uint32_t> local_slot;
+  if (module) {
+    auto found_segment = saved_segment(saved, *module);
+    if (auto *why = std::get_if<std::string>(&found_segment)) {
+      return bad(*why);
+    }
+    saved_in = std::get<1>(std::move(found_segment));
+    auto found_slots = local_slots(locals, *module);
+    if (!found_slots) {
+      return bad("it doesn't match module " + saved.module_path + ".");
+    }
+    local_slot = std::move(*found_slots);
+  }
+  const Program *saved_program =
+      saved_in ? &saved_in->program
+      : module && !module->lazy ? &module->program
+                                : nullptr;
+  if ((!module && !locals.empty()) || !fits(saved, saved_program)) {
+    return bad("it doesn't match module " + saved.module_path + ".");
+  }
+
+  /// Commit ///
+
+  current = std::move(module);
+  segment = std::move(saved_in);
+  global_state.replace(std::move(globals));
+  module_state.replace(std::move(module_vals));
+  module_slots.replace(std::move(slots));
+  query_cache.replace(std::move(cache));
+  next_ticket = saved.next_ticket;
+  step = saved.step;
+  block_visit = saved.block_visit;
+
+  cursor.reset();
+  local_state.clear();
+  if (current) {
+    // Rebinds the module's vars to the restored module state; the locals
+    // it clears are put back right after.
+    build_state(*current);
+    if (current->lazy) {
+      bind_locals(lazy_local_vars(*current->lazy));
+    }
+    for (size_t i = 0; i < locals.size(); i++) {
+      local_state[local_slot[i]] = std::move(locals[i].second);
+    }
+    apply_cursor(saved, program(), cursor);
+    // Pending keys aren't saved; they resolve the same against this state
+    QueryKey scratch;
+    for (auto &pending : cursor.resolution_stack) {
+      pending.key = query_key(*pending.call, scratch);
+    }
+  }
+  clear_journal();
+  mark_checkpoint();
+  dbg_out("Engine::restore: " << blob.size() << " bytes at pc " << saved.pc);
+  return std::nullopt;
+}
+
+// SECTION: DELTAS
+
+void Engine::mark_dirty(const VarRef &ref) {
+  switch (ref.scope) {
+  case VarScope::GLOBAL:
+    dirty_globals.mark(ref.index);
+    break;
+  case VarScope::MODULE:
+    dirty_module_vars.mark(ref.index);
+    break;
+  case VarScope::LOCAL:
+    break;
+  }
+}
+
+void Engine::mark_checkpoint() {
+  dirty_globals.clear();
+  dirty_module_vars.clear();
+  dirty_answers.clear();
+  has_checkpoint = true;
+  checkpoint_step = step;
+  checkpoint_block_visit = block_visit;
+  checkpoint_ticket = next_ticket;
+}
+
+std::vector<uint8_t> Engine::checkpoint() {
+  auto blob = snapshot();
+  mark_checkpoint();
+  return blob;
+}
+
+std::optional<std::vector<uint8_t>> Engine::delta() {
+  if (!has_checkpoint) {
+    return std::nullopt;
+  }
+  Writer w;
+  w.out.reserve(128);
+  w.out.insert(w.out.end(), DELTA_MAGIC, DELTA_MAGIC + 4);
+  w.num<uint16_t>(DELTA_VERSION);
+  w.num<uint64_t>(checkpoint_step);
+  w.num<uint64_t>(checkpoint_block_visit);
+  w.num<uint32_t>(checkpoint_ticket);
+
+  write_cursor(w, current.get(), segment.get(), current ? &program() : nullptr,
+               cursor, next_ticket, step, block_visit);
+
+  w.num<uint32_t>(dirty_globals.indices.size());
+  for (auto slot : dirty_globals.indices) {
+    w.num<uint32_t>(slot);
+    w.value((*global_state)[slot]);
+  }
+
+  w.num<uint32_t>(dirty_module_vars.indices.size());
+  if (!dirty_module_vars.indices.empty()) {
+    auto names = module_var_names(*module_slots, module_state->size());
+    for (auto index : dirty_module_vars.indices) {
+      w.num<uint32_t>(index);
+      w.str(*names[index]);
+      w.value((*module_state)[index]);
+    }
+  }
+
+  write_locals(w, local_state,
+               current ? local_names(*current) : std::vector<std::string>());
+
+  w.num<uint32_t>(dirty_answers.size());
+  for (auto &key : dirty_answers) {
+    write_answer(w, key, query_cache->at(key));
+  }
+
+  mark_checkpoint();
+  return std::move(w.out);
+}
+
+std::optional<Error> Engine::apply_delta(const std::vector<uint8_t> &blob) {
+  auto bad = [](const std::string &why) {
+    return Error(ERROR_BAD_SNAPSHOT, "Can't apply delta: " + why, 0);
+  };
+  Reader r(blob);
+  if (auto why = read_header(r, DELTA_MAGIC, DELTA_VERSION, "delta"))
+    return bad(*why);
+
+  auto base_step = r.num<uint64_t>();
+  auto base_block_visit = r.num<uint64_t>();
+  auto base_ticket = r.num<uint32_t>();
+  SavedCursor saved = read_cursor(r);
+
+  std::vector<std::pair<uint32_t, SimpleRValue>> globals(r.count(6));
+  for (auto &[slot, val] : globals) {
+    slot = r.num<uint32_t>();
+    val = r.value();
+  }
+
+  struct ModuleVar {
+    uint32_t index;
+    std::string name;
+    SimpleRValue val;
+  };
+  std::vector<ModuleVar> module_vars(r.count(10));
+  for (auto &var : module_vars) {
+    var.index = r.num<uint32_t>();
+    var.name = r.str();
+    var.val = r.value();
+  }
+
+  auto locals = read_locals(r);
+
+  std::vector<std::pair<QueryKey, CachedAnswer>> answers(
+      r.count(MIN_ANSWER_SIZE));
+  for (auto &answer : answers) {
+    answer = read_answer<CachedAnswer>(r);
+  }
+
+  if (!r.ok || r.pos != blob.size()) {
+    return bad("it's truncated or corrupt.");
+  }
+
+  /// Check it follows on from this engine's state ///
+
+  if (base_step != step || base_block_visit != block_visit ||
+      base_ticket != next_ticket) {
+    return bad("it doesn't follow on from this session's current state.");
+  }
+  for (auto &[slot, val] : globals) {
+    if (slot >= global_state->size() ||
+        val.index() != (*global_state)[slot].index()) {
+      return bad("it doesn't match the codex's globals.");
+    }
+  }
+  // Module vars new since the base are appended in the order they were
+  // declared; the rest must already be there under the same name.
+  auto names = module_var_names(*module_slots, module_state->size());
+  size_t module_size = module_state->size();
+  for (auto &var : module_vars) {
+    bool existing = var.index < names.size() && *names[var.index] == var.name;
+    bool appended = var.index == module_size && !module_slots->count(var.name);
+    if (!existing && !appended) {
+      return bad("its module vars don't match this session's.");
+    }
+    module_size += appended;
+  }
+
+  auto found = saved_module(saved.module_path, saved.source_hash, saved.lazy);
+  if (auto *why = std::get_if<std::string>(&found)) {
+    return bad(*why);
+  }
+  auto module = std::get<std::shared_ptr<const Module>>(std::move(found));
+  std::shared_ptr<const ParsedBlock> saved_in;
+  std::vector<uint32_t> local_slot;
+  if (module) {
+    auto found_segment = saved_segment(saved, *module);
+    if (auto *why = std::get_if<std::string>(&found_segment)) {
+      return bad(*why);
+    }
+    saved_in = std::get<1>(std::move(found_segment));
+    auto found_slots = local_slots(locals, *module);
+    if (!found_slots) {
+      return bad("it doesn't match module " + saved.module_path + ".");
+    }
+    local_slot = std::move(*found_slots);
+  }
+  const Program *saved_program =
+      saved_in ? &saved_in->program
+      : module && !module->lazy ? &module->program
+                                : nullptr;
+  if ((!module && !locals.empty()) || !fits(saved, saved_program)) {
+    return bad("it doesn't match module " + saved.module_path + ".");
+  }
+
+  /// Commit ///
+
+  if (!globals.empty()) {
+    auto &state = global_state.write();
+    for (auto &[slot, val] : globals) {
+      state[slot] = std::move(val);
+    }
+  }
+  if (!module_vars.empty()) {
+    auto &state = module_state.write();
+    for (auto &var : module_vars) {
+      if (var.index == state.size()) {
+        module_slots.write()[var.name] = var.index;
+        state.push_back(std::move(var.val));
+      } else {
+        state[var.index] = std::move(var.val);
+      }
+    }
+  }
+  if (!answers.empty()) {
+    auto &cache = query_cache.write();
+    for (auto &[key, cached] : answers) {
+      cache.insert_or_assign(std::move(key), std::move(cached));
+    }
+  }
+  next_ticket = saved.next_ticket;
+  step = saved.step;
+  block_visit = saved.block_visit;
+
+  current = std::move(module);
+  segment = std::move(saved_in);
+  cursor.reset();
+  local_state.clear();
+  if (current) {
+    build_state(*current);
+    if (current->lazy) {
+      bind_locals(lazy_local_vars(*current->lazy));
+    }
+    for (size_t i = 0; i < locals.size(); i++) {
+      local_state[local_slot[i]] = std::move(locals[i].second);
+    }
+    apply_cursor(saved, program(), cursor);
+    // Pending keys aren't saved; they resolve the same against this state
+    QueryKey scratch;
+    for (auto &pending : cursor.resolution_stack) {
+      pending.key = query_key(*pending.call, scratch);
+    }
+  }
+  clear_journal();
+  mark_checkpoint();
+  return std::nullopt;
+}
+
+} // namespace Skald
@@ -0,0 +1,207 @@
+#pragma once
+#include "skald.h"
+#include "tao/pegtl/position.hpp"
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace SkaldReference {
+
+inline ParsePosition from_pos(tao::pegtl::position pos) {
+  return ParsePosition{
+      .line = pos.line, .column = pos.column, .source = pos.source};
+}
+
+struct ParseState {
+
+  /** Constructor with filename */
+  ParseState(const std::string &filename, const Codex *c);
+
+  // SECTION: MODULE LEVEL
+
+  /** Pointer to the codex if there is one -- used for validation. */
+  const Codex *codex;
+
+  /** The module attached to the parsed file */
+  Module module;
+
+  // SECTION: ERROR HANDLING
+
+  std::vector<ParseError> errors;
+  void err(const tao::pegtl::position pos, std::string msg);
+  void warn(const tao::pegtl::position pos, std::string msg);
+
+  // SECTION: DECLARATIONS AND MODULE VARS
+
+  ValueType last_type;
+  bool declaration_was_typed;
+  bool declaration_was_valued;
+  std::vector<DeclaredVar> module_vars_stack;
+
+  // SECTION: TOP MATTER
+
+  enum TopMatterSection { NONE, TESTBED, LET };
+  TopMatterSection top_matter_section = TopMatterSection::NONE;
+
+  // SECTION: BLOCKS
+
+  std::string open_parent_tag;
+  std::string open_child_tag;
+  std::string open_grandchild_tag;
+
+  /** 0: parent, 1: child, 2: grandhchild */
+  int last_tag_level = 0;
+
+  /** The block currently under construction */
+  Block *current_block = nullptr;
+
+  /** Creates a block with the given tag and sets it as current in the parse
+   * state */
+  void start_block(const std::string &tag);
+
+  // SECTION: MEMBERS AND CONDITIONAL CHAINS
+
+  /** Adds a member either to the main thread, or the open conditional block */
+  void add_member(BlockMember mem);
+
+  /** Adds a member to the open choice */
+  void add_choice_member(Member mem);
+
+  /** Holds open chain if there is one. Members will be added to last block in
+   *  list. */
+  std::unique_ptr<ConditionalChain> open_chain;
+
+  // SECTION: BEATS
+
+  /** The current beat attribution tag */
+  std::string current_attrib_tag;
+
+  /** The current beat content stack */
+  std::vector<TextPart> beat_content_queue;
+
+  /** Stores text content as beat text (avoiding choice text issues) */
+  void store_beat_text();
+
+  /** Creates a beat and adds it to the current block */
+  void add_beat(int line_number);
+
+  // SECTION: CHOICES
+
+  /** Consolidates a choice group */
+  void add_choice_group(int line_number);
+
+  // SECTION: OPERATIONS
+
+  /** Stores pieces of a relative transition for parsing later */
+  struct RelMoveStep {
+    enum Type { PARENT, SIB, CHILD };
+    Type type;
+    std::string identifier;
+  };
+
+  /** Stack of relative movement steps for parsing */
+  std::vector<RelMoveStep> rel_move_steps;
+
+  /** Stores move identifier for transitions and GO statements */
+  std::string move_identifier_store;
+
+  /** Stores the raw member body until we can assemble it */
+  std::optional<MemberBody> member_body_buffer;
+
+  /** Validates a method and adds errors to the stack if any are found */
+  void validate_method(const MethodCall &m, const tao::pegtl::position pos);
+
+  // SECTION: TEXT
+
+  /** The current text stack */
+  std::vector<TextPart> text_content_queue;
+
+  /** Will either append to the last string if also a simple string, or add it
+   * to the stack if not. */
+  void add_text_string(std::string str);
+
+  /** This will hold the initial rval in an injectable so it can be used in
+   * whatever format the injectable ends up being. */
+  std::optional<RValue> injectable_buffer;
+
+  /** Pops the injectable buffer and returns the RValue to use */
+  RValue injectable_buffer_pop();
+
+  /** This holds ternary options until the ternary tail is complete, at which
+   * point these get committed to a given Insertion. */
+  std::vector<TernaryOption> ternary_option_queue;
+
+  // SECTION: CONDITIONALS
+
+  /** Buffer for nesting conditionals */
+  ConditionalAtom::Comparison current_comparison =
+      ConditionalAtom::Comparison::TRUTHY;
+
+  /** The conditional stack. `.back()` is always the one that's open. */
+  std::vector<Conditional> conditional_stack;
+  std::optional<Conditional> conditional_buffer;
+  std::vector<Choice> choice_stack;
+
+  /** Set up a new conditional and step the cursor into it */
+  void conditional_step_in();
+
+  /** Finalize the conditional on the cursor, and step out one level. Panics if
+   * there's nothing outside of this one. */
+  void conditional_step_out();
+
+  /** Will return the conditional held in the buffer if there is one, and clear
+   * it out */
+  std::optional<Conditional> conditional_buffer_pop();
+
+  /** Adds an atom (concrete base checker) to the checkable queue */
+  void add_conditional_atom(const ConditionalAtom &atom);
+
+  // SECTION: METHODS
+
+  /** Argument stack for method calls etc */
+  std::vector<RValue> argument_queue;
+
+  // SECTION: GO
+
+  /** Used to catch optional start tags for GO operations */
+  bool does_go_have_start_tag = false;
+
+  /** Stores the path for a GO command. Required, so don't need a pop method. */
+  std::string path_buffer;
+
+  // SECTION: RVALUES
+
+  /** Buffers the last-held rvalue */
+  std::vector<RValue> rval_buffer;
+
+  /** Returns the last buffered RValue, and pop it out of the buffer */
+  RValue rval_buffer_pop();
+
+  /** Returns a value off of the rval buffer and panics if it's not simple. */
+  SimpleRValue simple_rval_buffer_pop(tao::pegtl::position pos);
+
+  // SECTION: ATOMS
+
+  /** The last-parsed identifier */
+  std::string last_identifier;
+
+  /* Raw value buffers */
+  std::string string_buffer;
+  bool bool_buffer;
+
+  /** This will return an identifier string if one is present.
+   *  Use it like:
+   *  `if (auto value = pop_id()) { std::cout  << *value; }`
+   */
+  std::optional<std::string> pop_id_cond();
+
+  /** This returns whatever is in last_identifier and sets that value to an
+   *  empty string.
+   */
+  std::string pop_id();
+
+  /** Prints out result of parsing */
+  void do_dbg_desc();
+};
+
+} // namespace SkaldReference
@@ -0,0 +1,1089 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unistd.h>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+namespace SkaldReference {
+
+/** References a position in a codex or Skald module */
+struct ParsePosition {
+  size_t line;
+  size_t column;
+  std::string source;
+};
+
+/** Exception class for Skald parse errors */
+struct ParseError {
+  ParsePosition pos;
+  std::string msg;
+  enum Severity { WARNING, ERROR } severity = ERROR;
+  static ParseError file_error(std::string msg) {
+    return ParseError{.pos = ParsePosition{}, .msg = msg, .severity = ERROR};
+  }
+};
+
+enum SkaldLogLevel { VERBOSE, NORMAL, SPARSE, OFF };
+inline static SkaldLogLevel log_level = SkaldLogLevel::NORMAL;
+
+// Tracks its original line number; otherwise not special.
+struct LineEntity {
+  size_t line_number = 0;
+};
+
+/** Used for strong typing declarations and methods. Only method definitions
+ *  will ever be ACTION. */
+enum ValueType { STRING, BOOL, INT, FLOAT, ACTION };
+inline static std::string val_type_to_str(const ValueType &type) {
+  switch (type) {
+  case STRING:
+    return "string";
+    break;
+  case BOOL:
+    return "bool";
+    break;
+  case INT:
+    return "int";
+    break;
+  case FLOAT:
+    return "float";
+    break;
+  case ACTION:
+    return "action";
+    break;
+  }
+  return "!!INVALID!!";
+}
+
+enum class VarScope { GLOBAL, MODULE, LOCAL };
+inline std::string scope_to_str(VarScope s) {
+  switch (s) {
+  case VarScope::GLOBAL:
+    return "global";
+  case VarScope::MODULE:
+    return "module";
+  case VarScope::LOCAL:
+    return "local";
+  }
+  return "error";
+}
+
+struct Variable {
+  std::string name;
+  ValueType type;
+
+  std::string dbg_desc() const {
+    std::string ret = name + " (" + val_type_to_str(type) + +")";
+    return ret;
+  }
+};
+
+// Forward declarations
+struct MethodCall;
+using RValue = std::variant<std::string, bool, int, float, Variable,
+                            std::shared_ptr<MethodCall>>;
+
+// Rval helper functions
+inline const std::string *rval_get_str(const RValue &val) {
+  return std::get_if<std::string>(&val);
+}
+inline const int *rval_get_int(const RValue &val) {
+  return std::get_if<int>(&val);
+}
+inline const bool *rval_get_bool(const RValue &val) {
+  return std::get_if<bool>(&val);
+}
+inline const float *rval_get_float(const RValue &val) {
+  return std::get_if<float>(&val);
+}
+inline const Variable *rval_get_var(const RValue &val) {
+  return std::get_if<Variable>(&val);
+}
+inline const MethodCall *rval_get_call(const RValue &val) {
+  if (auto *p = std::get_if<std::shared_ptr<MethodCall>>(&val)) {
+    return p->get();
+  }
+  return nullptr;
+}
+
+using SimpleRValue = std::variant<std::string, bool, int, float>;
+
+inline SimpleRValue get_zero(ValueType t) {
+  switch (t) {
+  case INT:
+    return 0;
+  case FLOAT:
+    return 0.0f;
+  case STRING:
+    return "";
+  case BOOL:
+    return false;
+  default:
+    return false;
+  }
+}
+
+// Simple RVal helper functions
+inline const ValueType srval_get_type(const SimpleRValue &val) {
+  return std::visit(
+      [](const auto &value) -> ValueType {
+        using T = std::decay_t<decltype(value)>;
+        if constexpr (std::is_same_v<T, std::string>) {
+          return ValueType::STRING;
+        } else if constexpr (std::is_same_v<T, bool>) {
+          return ValueType::BOOL;
+        } else if constexpr (std::is_same_v<T, int>) {
+          return ValueType::INT;
+        } else if constexpr (std::is_same_v<T, float>) {
+          return ValueType::FLOAT;
+        }
+      },
+      val);
+}
+inline const std::string *srval_get_str(const SimpleRValue &val) {
+  return std::get_if<std::string>(&val);
+}
+inline const int *srval_get_int(const SimpleRValue &val) {
+  return std::get_if<int>(&val);
+}
+inline const bool *srval_get_bool(const SimpleRValue &val) {
+  return std::get_if<bool>(&val);
+}
+inline const float *srval_get_float(const SimpleRValue &val) {
+  return std::get_if<float>(&val);
+}
+
+/** Returns a bool reflecting the truthiness of a given simple RValue */
+inline bool is_simple_rval_truthy(const SimpleRValue &val) {
+  return std::visit(
+      [](const auto &value) -> bool {
+        using T = std::decay_t<decltype(value)>;
+        if constexpr (std::is_same_v<T, std::string>) {
+          return value.length() > 0;
+        } else {
+          return !!value;
+        }
+      },
+      val);
+}
+
+/** Attempts to cast an RValue to a SimpleRValue, returning nullopt if this is
+ * impossible. */
+inline std::optional<SimpleRValue> cast_rval_to_simple(const RValue &rval) {
+  return std::visit(
+      [](const auto &value) -> std::optional<SimpleRValue> {
+        using T = std::decay_t<decltype(value)>;
+        if constexpr (std::is_constructible_v<SimpleRValue, T>) {
+          return SimpleRValue(value);
+        } else {
+          return std::nullopt;
+        }
+      },
+      rval);
+}
+
+struct DeclaredVar : LineEntity {
+  SimpleRValue initial_value;
+  Variable var;
+};
+
+struct ArgDef {
+  std::string name;
+  ValueType type;
+  std::string dbg_desc() const { return name + ": " + val_type_to_str(type); }
+};
+
+struct MethodDef : LineEntity {
+  std::string name;
+  ValueType return_type;
+  std::vector<ArgDef> args;
+  std::string dbg_desc() const {
+    auto ret = name + "(";
+    auto i = 0;
+    for (auto &arg : args) {
+      ret += (i > 0 ? ", " : "") + arg.dbg_desc();
+      i++;
+    }
+    ret += ") -> " + val_type_to_str(return_type);
+    return ret;
+  }
+};
+
+struct MethodCall : LineEntity {
+  std::string method;
+  std::vector<RValue> args;
+  std::string dbg_desc() const; // Declare only for circular dep reasons
+};
+
+// rval_to_string must be declared before MethodCall::dbg_desc uses it
+template <typename VariantType>
+inline std::string rval_to_string(const VariantType &val) {
+  return std::visit(
+      [](const auto &value) -> std::string {
+        using T = std::decay_t<decltype(value)>;
+        if constexpr (std::is_same_v<T, std::string>) {
+          return value;
+        } else if constexpr (std::is_same_v<T, bool>) {
+          return value ? "{T}" : "{F}";
+        } else if constexpr (std::is_arithmetic_v<T>) {
+          return std::to_string(value);
+        } else if constexpr (std::is_same_v<T, Variable>) {
+          return value.name;
+        } else if constexpr (std::is_same_v<T, std::shared_ptr<MethodCall>>) {
+          return value->dbg_desc();
+        }
+      },
+      val);
+}
+
+/** The key used to encode a query for answer caching */
+inline std::string key_for_call(MethodCall &call) {
+  std::string ret = call.method;
+  for (auto &arg : call.args) {
+    ret += "|" + rval_to_string(arg);
+  }
+  return ret;
+}
+
+// Now define MethodCall::dbg_desc after rval_to_string is available
+inline std::string MethodCall::dbg_desc() const {
+  std::string ret = "CALL " + method + ": ";
+  for (const auto &arg : args) {
+    ret += rval_to_string(arg) + " ";
+  }
+  return ret;
+}
+
+struct ConditionalAtom {
+  enum Comparison {
+    TRUTHY,
+    NOT_TRUTHY,
+    EQUALS,
+    NOT_EQUALS,
+    MORE,
+    LESS,
+    MORE_EQUAL,
+    LESS_EQUAL
+  };
+  static Comparison comparison_for_operator(const std::string op) {
+    if (op == "=")
+      return Comparison::EQUALS;
+    if (op == "!=")
+      return Comparison::NOT_EQUALS;
+    if (op == ">")
+      return Comparison::MORE;
+    if (op == "<")
+      return Comparison::LESS;
+    if (op == ">=")
+      return Comparison::MORE_EQUAL;
+    if (op == "<=")
+      return Comparison::LESS_EQUAL;
+    return TRUTHY;
+  }
+  RValue a;
+  Comparison comparison;
+  std::optional<RValue> b;
+  std::string dbg_desc() const {
+    switch (comparison) {
+    case TRUTHY:
+      return "IS " + rval_to_string(a) + "?";
+    case NOT_TRUTHY:
+      return "IS NOT " + rval_to_string(a) + "?";
+    case EQUALS:
+      return "IS " + rval_to_string(a) + " = " + rval_to_string(*b) + "?";
+    case NOT_EQUALS:
+      return "IS " + rval_to_string(a) + " != " + rval_to_string(*b) + "?";
+    case MORE:
+      return "IS " + rval_to_string(a) + " > " + rval_to_string(*b) + "?";
+    case LESS:
+      return "IS " + rval_to_string(a) + " < " + rval_to_string(*b) + "?";
+    case MORE_EQUAL:
+      return "IS " + rval_to_string(a) + " >= " + rval_to_string(*b) + "?";
+    case LESS_EQUAL:
+      return "IS " + rval_to_string(a) + " <= " + rval_to_string(*b) + "?";
+    }
+  }
+};
+
+struct Conditional;
+using ConditionalItem =
+    std::variant<ConditionalAtom, std::shared_ptr<Conditional>>;
+
+// Forward-declared:
+/** Returns the debug text describing a ConditionalItem, which can be an atom or
+ * a clause. */
+std::string dbg_desc_conditional_item(const ConditionalItem &item);
+
+struct Conditional : LineEntity {
+  enum Type { AND, OR };
+  Type type = Type::AND;
+  std::vector<ConditionalItem> items;
+
+  std::string dbg_desc() const {
+    std::string ret = "[IF: ";
+    int i = 0;
+    for (auto item : items) {
+      if (i > 0)
+        ret += type == Type::AND ? " AND " : " OR ";
+      ret += dbg_desc_conditional_item(item);
+      i++;
+    }
+    ret += "]";
+    return ret;
+  }
+};
+
+inline std::string dbg_desc_conditional_item(const ConditionalItem &item) {
+  return std::visit(
+      [](const auto &value) -> std::string {
+        using T = std::decay_t<decltype(value)>;
+        if constexpr (std::is_same_v<T, ConditionalAtom>) {
+          return value.dbg_desc();
+        } else if constexpr (std::is_same_v<T, std::shared_ptr<Conditional>>) {
+          return value->dbg_desc();
+        }
+      },
+      item);
+}
+
+struct TestbedSet : LineEntity {
+  std::string variable;
+  SimpleRValue test_value;
+  std::string dbg_desc() const {
+    return "  -> " + variable + " = " + rval_to_string(test_value);
+  }
+};
+
+struct Testbed : LineEntity {
+  std::string name;
+  std::vector<TestbedSet> declarations;
+  std::string dbg_desc() const {
+    std::string ret = "@" + name + ":";
+    for (auto &dec : declarations) {
+      ret += "\n" + dec.dbg_desc();
+    }
+    return ret;
+  }
+};
+
+struct Mutation : LineEntity {
+  enum Type { EQUATE, SWITCH, ADD, SUBTRACT };
+  std::string lvalue;
+  Type type;
+  std::optional<RValue> rvalue;
+  static std::string label_for_type(Type t) {
+    switch (t) {
+    case EQUATE:
+      return "EQUALS";
+      break;
+    case SWITCH:
+      return "SWITCH";
+      break;
+    case ADD:
+      return "ADD";
+      break;
+    case SUBTRACT:
+      return "SUBTRACT";
+      break;
+    }
+  }
+  std::string dbg_desc() const {
+    std::string ret = "<" + lvalue + " " + label_for_type(type);
+    if (rvalue) {
+      ret += " " + rval_to_string(*rvalue);
+    }
+    return ret + ">";
+  }
+};
+
+struct GoModule : LineEntity {
+  std::string module_path;
+  std::string dbg_desc() const {
+    return module_path +
+           (start_in_tag.length() > 0 ? " > " + start_in_tag : "");
+  }
+  std::string start_in_tag;
+};
+
+struct Exit : LineEntity {
+  std::optional<RValue> argument;
+  std::string dbg_desc() const {
+    if (argument) {
+      return rval_to_string(*argument);
+    } else {
+      return "<no argument>";
+    }
+  }
+};
+
+struct Move : LineEntity {
+  std::string target_tag;
+};
+
+/* DEBUG OUTPUT STUFF TO DELETE LATER */
+
+struct OpDebugProcessor {
+  std::string operator()(const Move &move) {
+    return "MOVE TO: " + move.target_tag;
+  }
+  std::string operator()(const MethodCall &method_call) {
+    return "CALL: " + method_call.dbg_desc();
+  }
+  std::string operator()(const Mutation &mutation) {
+    return "MUTATE: " + mutation.dbg_desc();
+  }
+  std::string operator()(const GoModule &go) {
+    return "GO TO: " + go.dbg_desc();
+  }
+  std::string operator()(const Exit &exit) {
+    return "EXIT: " + exit.dbg_desc();
+  }
+};
+
+using TernaryOption = std::tuple<RValue, RValue>;
+
+struct TernaryInsertion {
+  RValue check;
+  bool check_truthy = false;
+  std::vector<TernaryOption> options;
+  std::string dbg_desc() const {
+    std::string ret = "{> " + rval_to_string(check) + "? ";
+    for (auto &opt : options) {
+      ret += rval_to_string(std::get<0>(opt)) + ":" +
+             rval_to_string(std::get<1>(opt));
+    }
+    ret += "}";
+    return ret;
+  }
+};
+
+struct ChanceOption {
+  int weight;
+  RValue value;
+  std::string dbg_desc() {
+    return std::to_string(weight) + ":" + rval_to_string(value);
+  }
+};
+
+struct ChanceInsertion {
+  std::vector<ChanceOption> options;
+  std::string dbg_desc() {
+    std::string ret = "{> DICE ? ";
+    for (auto &opt : options) {
+      ret += opt.dbg_desc();
+    }
+    ret += "}";
+    return ret;
+  }
+};
+
+struct SimpleInsertion {
+  RValue rvalue;
+  std::string dbg_desc() { return rval_to_string(rvalue); }
+};
+
+using TextPart = std::variant<std::string, SimpleInsertion, TernaryInsertion>;
+
+struct TextContent {
+  std::vector<TextPart> parts;
+  std::string dbg_desc() const {
+    std::string ret = "";
+    for (auto &part : parts) {
+      if (std::holds_alternative<std::string>(part)) {
+        ret += std::get<std::string>(part);
+      } else if (std::holds_alternative<TernaryInsertion>(part)) {
+        auto ins = std::get<TernaryInsertion>(part);
+        ret += "{" + ins.dbg_desc() + "}";
+      } else {
+        auto ins = std::get<SimpleInsertion>(part);
+        ret += "{" + ins.dbg_desc() + "}";
+      }
+    }
+    return ret;
+  }
+};
+
+// STUB: Build AttachedCondition
+// This is an optional condition. If one is not present, it will pass; otherwise
+// the conditional will be resolved.
+struct AttachedCondition {
+  std::optional<Conditional> condition;
+
+  // Allows truthy checks:
+  explicit operator bool() const { return condition.has_value(); }
+  std::string dbg_desc() const {
+    return (condition ? condition->dbg_desc() + " " : "");
+  }
+};
+
+/** A narrative beat (text; attributed or not.) */
+struct Beat : LineEntity {
+  std::string attribution;
+  TextContent content;
+
+  std::string dbg_desc() const {
+    return (attribution.length() > 0 ? attribution + ": " : "") + "<beat>";
+  }
+};
+
+/** The raw types contained by a Member: Move, MethodCall,
+ *  Mutation, GoModule, Exit, or Beat. */
+using MemberBody =
+    std::variant<Move, MethodCall, Mutation, GoModule, Exit, Beat>;
+
+/** A member of a block (excludes CGs) or choice. .body: MemberBody, and ac:
+ *  AttachedCondition. */
+struct Member : LineEntity {
+  MemberBody body;
+  AttachedCondition ac;
+
+  const Move *get_move() const { return std::get_if<Move>(&body); }
+  const MethodCall *get_call() const { return std::get_if<MethodCall>(&body); }
+  const Mutation *get_mutation() const { return std::get_if<Mutation>(&body); }
+  const GoModule *get_go_module() const { return std::get_if<GoModule>(&body); }
+  const Exit *get_exit() const { return std::get_if<Exit>(&body); }
+  const Beat *get_beat() const { return std::get_if<Beat>(&body); }
+
+  bool is_move() const { return std::holds_alternative<Move>(body); }
+  bool is_call() const { return std::holds_alternative<MethodCall>(body); }
+  bool is_mutation() const { return std::holds_alternative<Mutation>(body); }
+  bool is_go_module() const { return std::holds_alternative<GoModule>(body); }
+  bool is_exit() const { return std::holds_alternative<Exit>(body); }
+  bool is_beat() const { return std::holds_alternative<Beat>(body); }
+
+  std::string dbg_desc() const {
+    std::string type = is_move()        ? "Move"
+                       : is_call()      ? "MethodCall"
+                       : is_mutation()  ? "Mutation"
+                       : is_go_module() ? "GoModule"
+                       : is_exit()      ? "Exit"
+                       : is_beat()      ? "Beat"
+                                        : "Unknown";
+    return type + " " + ac.dbg_desc();
+  }
+};
+
+struct Choice : LineEntity {
+  AttachedCondition condition;
+  TextContent content;
+  std::vector<Member> members;
+
+  std::string dbg_desc() const {
+    return condition.dbg_desc() + content.dbg_desc() + " (" +
+           std::to_string(members.size()) + " members)";
+  }
+};
+
+// This contains one or more choices, exists at any place in a block,
+// and blocks proceeding until a choice is selected. If no individual
+// choice is available, the group will be ignored.
+struct ChoiceGroup : LineEntity {
+  std::vector<Choice> choices;
+};
+
+/** A Beat, LineOp, or ChoiceGroup. Child of a Block or a ConditionalBlock. */
+using BlockMember = std::variant<Member, ChoiceGroup>;
+
+/** A block in a conditional chain. If cond is null, this is an else block. */
+struct ConditionalBlock : LineEntity {
+  AttachedCondition cond;
+  std::vector<BlockMember> members;
+};
+
+/** A string of 1-n conditional blocks: if, elseif..., endif. */
+struct ConditionalChain {
+  std::vector<ConditionalBlock> cond_blocks;
+};
+
+using MainBlockMember = std::variant<BlockMember, ConditionalChain>;
+inline bool mbm_is_chain(const MainBlockMember &m) {
+  return std::holds_alternative<ConditionalChain>(m);
+}
+
+struct Block : LineEntity {
+  std::string tag;
+  std::vector<MainBlockMember> members{};
+};
+
+/** The Codex defines globals, methods, and project root. Only one codex is
+ * active on the engine at a time. Resetting codex resets state. */
+struct Codex {
+  std::string path;
+  std::string filename;
+
+  /** Global-scoped variables */
+  std::vector<DeclaredVar> global_vars;
+
+  /** Method definitions */
+  std::vector<MethodDef> method_defs;
+
+  /** Full path to the codex file itself. */
+  std::string codex_path() {
+    return (std::filesystem::path(path) / filename).string();
+  }
+
+  /** Resolves a module path relative to the codex's directory: with a codex
+   *  at ~/project/example.codex, "a/b/c.ska" -> "~/project/a/b/c.ska". */
+  std::string resolve_path(const std::string &rel_path) {
+    return (std::filesystem::path(path) / rel_path).string();
+  }
+};
+
+/** A Module is a single Skald file. Only one module is loaded at a time, but
+ *  global state persists between modules, and module vars get pushed on GO
+ *  transitions. */
+struct Module {
+  std::string filename;
+  std::vector<DeclaredVar> module_vars;
+  std::vector<Testbed> testbeds;
+  std::vector<Block> blocks;
+  std::unordered_map<std::string, size_t> block_lookup;
+
+  int get_block_index(const std::string &tag) {
+    auto it = block_lookup.find(tag);
+    return it != block_lookup.end() ? it->second : -1;
+  }
+};
+
+// SECTION: Gameplay structs
+
+struct Chunk {
+  std::string text;
+};
+
+struct Option {
+  std::vector<Chunk> text;
+  bool is_available;
+};
+
+/** This contains actual Skald content */
+struct Content {
+  std::string attribution = "";
+  std::vector<Chunk> text;
+};
+
+// Contains one or more options
+struct OptionGroup {
+  std::vector<Option> options;
+};
+
+/** This posts the method out to the client, and is used to key the result back
+ * into Skald state. */
+struct MethodCallGet {
+  MethodCall call;
+  size_t line_number = 0;
+  std::string get_key() { return key_for_call(call); }
+};
+
+struct MethodCallPost {
+  MethodCall call;
+  size_t line_number = 0;
+};
+
+/** This carries error information for anything that goes so wrong that the
+ *  engine has to stop */
+const uint ERROR_UNKNOWN = 0;
+const uint ERROR_EOF = 1;
+const uint ERROR_EMPTY_MODULE = 2;
+const uint ERROR_MODULE_TAG_NOT_FOUND = 3;
+const uint ERROR_CHOICE_OUT_OF_BOUNDS = 4;
+const uint ERROR_CHOICE_UNAVAILABLE = 5;
+const uint ERROR_EXPECTED_ANSWER = 6;
+const uint ERROR_RESOLUTION_QUEUE_EMPTY = 7;
+const uint ERROR_TYPE_MISMATCH = 8;
+const uint ERROR_UNEXPECTED_NULL = 9;
+const uint ERROR_VAR_UNDEFINED = 10;
+const uint ERROR_UNEXPECTED_ACT = 11;
+const uint ERROR_LOADING_MODULE = 12;
+const uint ERROR_NO_GLOBAL = 13;
+const uint ERROR_OUT_OF_BOUNDS = 14;
+const uint ERROR_START_EMPTY_BLOCK = 15;
+struct Error {
+  uint code = 0;
+  std::string message;
+  size_t line_number;
+
+  Error(uint code, std::string message, size_t line_number)
+      : code(code), message(std::move(message)), line_number(line_number) {}
+};
+
+/** Added to warning stack when non-breaking warnings happen */
+struct Warning {
+  std::string message;
+  size_t line_number;
+};
+
+/** Will be sent back by the client as an answer to the current open query --
+ *  will be undefined if no value is returned. Undefined will not be keyed into
+ *  the map, which will be treated as falsy if used in a conditional. */
+struct QueryAnswer {
+  std::optional<SimpleRValue> val;
+};
+
+struct Notification {
+  std::string var_name;
+  Mutation::Type mut_type;
+  std::optional<SimpleRValue> rval; // Real value, resolved out
+  VarScope scope;
+  std::string dbg_desc() const {
+    std::string v = rval ? rval_to_string(*rval) : "<no rvalue>";
+    return var_name + " " + Mutation::label_for_type(mut_type) + " " + v +
+           " (" + scope_to_str(scope) + ")";
+  }
+};
+
+/** Empty struct signifying that the script is concluded. */
+struct End {
+
+  /** Optionally stores a reason for hitting an end; useful for debugging. */
+  std::string reason;
+
+  End(std::string reason = "") : reason(std::move(reason)) {}
+};
+
+/** Will contain either a Content struct or a Query */
+using Response = std::variant<Content, MethodCallGet, MethodCallPost, Exit,
+                              GoModule, OptionGroup, End, Error, Notification>;
+
+enum class ResponseType {
+  CONTENT,
+  QUERY,
+  EXIT,
+  GO_MODULE,
+  END,
+  ERROR,
+  UNKNOWN
+};
+
+/** Returns the type of response we're dealing with */
+inline ResponseType get_response_type(Response &response) {
+  return std::visit(
+      [](auto &&arg) -> ResponseType {
+        using T = std::decay_t<decltype(arg)>;
+        if constexpr (std::is_same_v<T, Content>)
+          return ResponseType::CONTENT;
+        else if constexpr (std::is_same_v<T, MethodCallGet>)
+          return ResponseType::QUERY;
+        else if constexpr (std::is_same_v<T, Exit>)
+          return ResponseType::EXIT;
+        else if constexpr (std::is_same_v<T, GoModule>)
+          return ResponseType::GO_MODULE;
+        else if constexpr (std::is_same_v<T, End>)
+          return ResponseType::END;
+        else if constexpr (std::is_same_v<T, Error>)
+          return ResponseType::ERROR;
+        else
+          return ResponseType::UNKNOWN;
+      },
+      response);
+}
+
+/** Will be sent back by the client following a response, to indicate the
+ * next action */
+struct Action {
+  int selection;
+};
+
+/** Marks where we are in the module, and what is expected from the client
+ * next
+ */
+struct Cursor {
+
+  /** If this is not empty, it marks the block that the engine should jump to on
+   * the next advance_cursor */
+  std::string queued_transition;
+
+  /** Is the next member pre-processed, queries queued etc */
+  bool is_preprocessed = false;
+
+  /** Which block are we currently in */
+  int current_block_index = 0;
+
+  /** Which part are we currently working through */
+  int current_member_index = 0;
+
+  /** If we are in a conditional thread, which block? */
+  int thread_block = 0;
+
+  /** We've processed the conditionals sufficiently to enter a block */
+  bool entered_thread_block = false;
+
+  /** And which member in that block? */
+  int thread_member = 0;
+
+  /** Which choice do we need to process? */
+  int choice_selection = -1;
+
+  /** If >= 0, we are stepping through the operations of a choice. */
+  int choice_thread_index = 0;
+
+  /** If this is present, do an exit */
+  Exit *queued_exit = nullptr;
+
+  /** If this is present, do a transition */
+  GoModule *queued_go = nullptr;
+
+  /** These track method calls etc. that require queries to the external client.
+   *  These have to be resolved by the client via the answer() method before the
+   *  engine will proceed. */
+  std::vector<MethodCallGet> resolution_stack;
+
+  /** Adds more MethodCallGets to the resolution stack. */
+  void add_to_res_stack(std::vector<MethodCallGet> res) {
+    resolution_stack.insert(resolution_stack.end(), res.begin(), res.end());
+  }
+
+  /** This will reset the cursor to a "new" state. Currently only called on
+   *  module entry. */
+  void reset() {
+    resolution_stack.clear();
+    queued_exit = NULL;
+    queued_go = NULL;
+    queued_transition = "";
+    choice_selection = -1;
+    choice_thread_index = 0;
+    current_block_index = 0;
+    current_member_index = 0;
+    entered_thread_block = false;
+    is_preprocessed = false;
+    // did_last_condition_pass = true;
+  }
+};
+
+enum ProgressResult { OK, END_OF_FILE, MODULE_NOT_FOUND };
+
+struct ParseResult {
+  bool ok;
+  std::vector<ParseError> exceptions;
+  static ParseResult with(std::vector<ParseError> exceptions) {
+    bool ok = true;
+    for (auto &ex : exceptions) {
+      if (ex.severity == ParseError::ERROR) {
+        ok = false;
+        break;
+      }
+    }
+    return ParseResult{.ok = ok, .exceptions = exceptions};
+  }
+  static ParseResult fail(std::string msg) {
+    auto errors = {ParseError::file_error(msg)};
+    return ParseResult{.ok = false, .exceptions = errors};
+  }
+};
+
+// SECTION: Main Engine
+
+/** Function should return text of Skald module when given a Skald path
+ * (relative to codex or absolute). Returns nullopt if the source can't be found
+ * or read. Lets embedders with a virtual filesystem (Godot res://, archives,
+ * network, in-memory) supply bytes; default reads from the OS filesystem.
+ */
+using SourceReader =
+    std::function<std::optional<std::string>(const std::string &resolved_path)>;
+
+/** Default SourceReader: basic fs reader. */
+std::optional<std::string> default_source_reader(const std::string &path);
+
+class Engine {
+public:
+  ParseResult setup(std::string path);
+  ParseResult load(std::string path);
+  void trace(std::string path);
+
+  /** Set source reader for loading raw content of files / abstract entities
+   * etc. */
+  void set_source_reader(SourceReader reader);
+
+  // Actions
+  /** Start the Skald engine at a particular tag. This sets the cursor to the
+   * first beat in this block. */
+  Response start_at(std::string tag);
+
+  /** Start the engine at the first block in the file. This sets the cursor to
+   * the first beat in the file as well. */
+  Response start();
+
+  /** Call this to answer to a Content response; either the index of a
+   *  choice if there are choices, or any integer otherwise. */
+  Response act(int choice_index = 0);
+
+  /** Get the current response that's awaiting action */
+  Response get_current();
+
+  /** Call this to answer a Query response; either the value that should be
+   * returned if a return is expected, or null if not. */
+  Response answer(std::optional<QueryAnswer> answer);
+
+  /** Sets global state; errors if global doesn't exist or type mismatch. */
+  std::optional<Error> set(std::string key, SimpleRValue val);
+
+  /** Returns state; errors if not set. */
+  std::variant<Error, SimpleRValue> get(std::string key);
+
+  /// PROJECT STUFF ///
+  std::optional<std::string> get_project_root();
+  std::optional<std::string> get_codex_name();
+
+  /// DEBUG STUFF ///
+  std::string dbg_print_cache() {
+    std::string ret;
+    for (const auto &[key, value] : query_cache) {
+      ret += key + ": " + rval_to_string(value) + "\n";
+    }
+    return ret;
+  }
+
+private:
+  /** Main loop processor */
+  Response next();
+
+  ///--  MODULE AND STATE  --///
+
+  /** If codex is not present, globals and methods will not be available, and GO
+   *  subfolder paths will not resolve properly. */
+  std::unique_ptr<Codex> codex;
+
+  /** The currently loaded module */
+  std::unique_ptr<Module> current;
+
+  /** Source fetcher. Empty => filesystem default (default_source_reader). */
+  SourceReader reader_;
+
+  /** Not cleared */
+  std::unordered_map<std::string, SimpleRValue> global_state;
+
+  /** Cleared on EXIT */
+  std::unordered_map<std::string, SimpleRValue> module_state;
+
+  /** Cleared on every new module start */
+  std::unordered_map<std::string, SimpleRValue> local_state;
+
+  std::unordered_map<std::string, SimpleRValue> query_cache;
+
+  /** Initializes state after a codex is loaded */
+  void init_state();
+  void build_state(const Module &module);
+
+  ///--  UTIL  --///
+  // ConditionalChain *get_current_conditional_chain();
+
+  /** Gets the current block for the cursor */
+  Block &cursor_block();
+
+  /** Gets current MainBlockMember (BM or CT) where we already know block */
+  MainBlockMember &cursor_mbm(Block &block);
+
+  /** Gets current MainBlockMember (BM or CT) from scratch */
+  MainBlockMember &cursor_mbm();
+
+  /** Gets current BlockMember (Mem or CG), including in a CT, where we already
+   * know the parent MBM (which either is this, or is the parent) */
+  BlockMember &cursor_bm(MainBlockMember &mbm);
+
+  /** Gets current BlockMember (Mem or CG), including in a CT, where we don't
+   * know the parent MBM (which either is this, or is the parent) */
+  BlockMember &cursor_bm();
+
+  /** Gets current member; may be MBM:BM:Mem, may be child, or may be child of a
+   * choice in a CG. In this case we know the parent / superclass BM. */
+  Member &cursor_mem(BlockMember &bm);
+
+  /** Gets current member; may be MBM:BM:Mem, may be child, or may be child of a
+   * choice in a CG. */
+  Member &cursor_mem();
+
+  /** This zeroes the state and drops us in at this beat index, e.g. from an
+   *  external entry point. It also initializes Skald state, leaving extant
+   *  state intact. */
+  Response enter(int block, int beat);
+
+  std::optional<Error> advance_cursor(int from_line_number = 0);
+
+  ///--  ENGINE LOGIC FLOW  --///
+
+  std::vector<Warning> warnings;
+
+  /** Log to the warning stack without blocking operation */
+  void warn(std::string tx, size_t ln = 0);
+
+  /** Performs a mutation. Returns either error or a notification that can be
+   *  sent directly to the client. */
+  std::variant<Error, Notification> do_mutation(Mutation &mut);
+
+  std::optional<Response> do_member(Member &mem);
+
+  /** Queues the member's conditional for processing. */
+  void setup_mbm(MainBlockMember &mbm);
+
+  /** Queues conditional for a bock member */
+  void setup_bm(BlockMember &bm);
+
+  /** Queues conditional, rvalue methods, or arg menus */
+  void setup_member(Member &member);
+
+  ///-- RESOLUTION --///
+
+  static const char *scope_to_string(VarScope s) {
+    switch (s) {
+    case VarScope::GLOBAL:
+      return "global";
+    case VarScope::MODULE:
+      return "module";
+    case VarScope::LOCAL:
+      return "local";
+    }
+    return "unknown";
+  }
+
+  struct ScopeMap {
+    VarScope scope;
+    std::unordered_map<std::string, SimpleRValue> &map;
+  };
+
+  /** Returns the scope maps in lookup-priority order: global, module, local. */
+  std::array<ScopeMap, 3> scopes();
+
+  /** Gets a var, preferring global, module, then local. Gets false if local,
+   *  and warns. */
+  SimpleRValue var_get(const std::string var_name);
+
+  /** Set a variable, preferring global, module, and then local var. Sets as
+   *  local if not exists. */
+  std::variant<Error, VarScope>
+  var_set(const std::string var_name, const SimpleRValue &rval, size_t ln = 0);
+
+  /** Will switch a bool. Throws an error if not a bool, and a warning if not
+   *  previously set (and sets to false in this case) */
+  std::variant<Error, VarScope> var_switch(const std::string var_name,
+                                           size_t ln = 0);
+
+  /** Will mathematically mutate a float or int. Errors if string or bool, or if
+   * arg is string or bool. floats and ints can be used interchangeably (int -
+   * float will round down). If sign is false, will subtract. */
+  std::variant<Error, VarScope> var_add(const std::string var_name,
+                                        const SimpleRValue &rval, bool sign,
+                                        size_t ln = 0);
+
+  SimpleRValue resolve_rval_to_simple(const RValue &rval);
+  bool resolve_conditional_atom(const ConditionalAtom &atom);
+  bool resolve_conditional_item(const ConditionalItem &item);
+  bool resolve_condition(const std::optional<Conditional> &cond);
+  bool resolve_condition(const Conditional &cond);
+  bool resolve_condition(const AttachedCondition &cond);
+  std::string resolve_simple(const SimpleInsertion &ins);
+  std::string resolve_tern(const TernaryInsertion &tern);
+  std::vector<Chunk> resolve_text(const TextContent &text_content);
+
+  Cursor cursor;
+};
+
+} // namespace SkaldReference
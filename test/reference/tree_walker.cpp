@@ -0,0 +1,108 @@
+#include "tree_walker.h"
+#include "skald.h"
+
+namespace SkaldReference {
+
+static QueryAnswer answer_for(const MethodCall &call) {
+  if (call.method == "returns_something") {
+    return QueryAnswer{.val = 5};
+  }
+  if (call.method == "returns_w_args") {
+    return QueryAnswer{.val = std::string("answered")};
+  }
+  return QueryAnswer{};
+}
+
+static std::string stitch(const std::vector<Chunk> &chunks) {
+  std::string text;
+  for (auto &chunk : chunks) {
+    text += chunk.text;
+  }
+  return text;
+}
+
+static std::string describe(const Response &response,
+                            const std::string &root) {
+  return std::visit(
+      [&](const auto &r) -> std::string {
+        using T = std::decay_t<decltype(r)>;
+        if constexpr (std::is_same_v<T, Content>) {
+          return "content " + r.attribution + "|" + stitch(r.text);
+        } else if constexpr (std::is_same_v<T, OptionGroup>) {
+          std::string ret = "options";
+          for (auto &opt : r.options) {
+            ret += " [" + stitch(opt.text) + (opt.is_available ? "]" : " x]");
+          }
+          return ret;
+        } else if constexpr (std::is_same_v<T, MethodCallGet>) {
+          return "get " + r.call.dbg_desc();
+        } else if constexpr (std::is_same_v<T, MethodCallPost>) {
+          return "post " + r.call.dbg_desc();
+        } else if constexpr (std::is_same_v<T, Notification>) {
+          return "notify " + r.dbg_desc();
+        } else if constexpr (std::is_same_v<T, GoModule>) {
+          return "go " + r.dbg_desc();
+        } else if constexpr (std::is_same_v<T, Exit>) {
+          return "exit " + r.dbg_desc();
+        } else if constexpr (std::is_same_v<T, End>) {
+          return "end";
+        } else if constexpr (std::is_same_v<T, Error>) {
+          std::string message = r.message;
+          for (size_t at; (at = message.find(root)) != std::string::npos;) {
+            message.erase(at, root.size());
+          }
+          return "error " + std::to_string(r.code) + " " + message;
+        }
+      },
+      response);
+}
+
+static bool is_final(const Response &response) {
+  return std::holds_alternative<Exit>(response) ||
+         std::holds_alternative<End>(response) ||
+         std::holds_alternative<Error>(response);
+}
+
+std::string play_described(const std::string &codex_path,
+                           const std::string &module,
+                           const std::vector<int> &choices, size_t max_steps,
+                           const std::string &root) {
+  std::string lines;
+  Engine engine;
+  if (!engine.setup(codex_path).ok || !engine.load(module).ok) {
+    lines += "couldn't load " + module + "\n";
+    return lines;
+  }
+
+  Response response = engine.start();
+  size_t next_choice = 0;
+  for (size_t n = 1;; n++) {
+    if (!std::holds_alternative<MethodCallGet>(response)) {
+      lines += describe(response, root) + "\n";
+    }
+    if (is_final(response) || n == max_steps) {
+      break;
+    }
+    if (std::holds_alternative<OptionGroup>(response)) {
+      if (next_choice == choices.size()) {
+        break;
+      }
+      response = engine.act(choices[next_choice++]);
+    } else if (auto *get = std::get_if<MethodCallGet>(&response)) {
+      response = engine.answer(answer_for(get->call));
+    } else if (auto *go = std::get_if<GoModule>(&response)) {
+      if (!engine.load(go->module_path).ok) {
+        response = Error(ERROR_LOADING_MODULE,
+                         "Couldn't load " + go->module_path, go->line_number);
+      } else {
+        response = go->start_in_tag.empty() ? engine.start()
+                                            : engine.start_at(go->start_in_tag);
+      }
+    } else {
+      response = engine.act(0);
+    }
+  }
+  return lines;
+}
+
+} // namespace SkaldReference
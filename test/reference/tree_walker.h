@@ -0,0 +1,26 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// The engine as it was before modules were compiled into a flat program: it
+// walks Block -> MainBlockMember -> BlockMember -> Member on every step. The
+// other files here are that engine's sources, kept as they were apart from
+// the namespace (SkaldReference, so it links next to Skald; logger.h's Log
+// moved into it too) and the include of skald.h. The tests play it next to
+// the compiled engine and compare.
+
+namespace SkaldReference {
+
+/** Plays module on the tree walker, set up on codex_path, the same way
+ *  SkaldTest::play does: taking choices at each menu in turn, answering
+ *  queries as SkaldTest::answer_for does and following GOs, for at most
+ *  max_steps responses. Returns a line for each response, as
+ *  SkaldTest::describe writes it with root stripped from error messages;
+ *  queries are answered but left out. */
+std::string play_described(const std::string &codex_path,
+                           const std::string &module,
+                           const std::vector<int> &choices, size_t max_steps,
+                           const std::string &root);
+
+} // namespace SkaldReference
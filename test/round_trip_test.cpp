@@ -0,0 +1,212 @@
+#include "skald_test.h"
+#include <doctest/doctest.h>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+using namespace SkaldTest;
+
+// Whatever a session goes through (saved and restored, rewound, loaded from a
+// pack or compiled) it has to carry on exactly as one that never did, down
+// every path through every module under test/.
+
+/** Calls check(module, choices) for every path through module */
+template <typename Check>
+static void each_path(const std::string &module, bool lazy, Check check) {
+  Engine walker = engine_for(module, lazy);
+  for (auto &choices : choice_paths(walker, walker.start())) {
+    std::string path = module + ":";
+    for (int choice : choices) {
+      path += " " + std::to_string(choice);
+    }
+    CAPTURE(path);
+    check(module, choices);
+  }
+}
+
+/** Calls check(module, choices) for every path through every module */
+template <typename Check> static void each_path(bool lazy, Check check) {
+  for (auto &module : test_modules()) {
+    each_path(module, lazy, check);
+  }
+}
+
+/** The choices left to make from step index of steps on */
+static std::vector<int> choices_from(const std::vector<Step> &steps,
+                                     const std::vector<int> &choices,
+                                     size_t index) {
+  return {choices.begin() + choices_before(steps, index), choices.end()};
+}
+
+static std::string read_file(const std::string &path) {
+  std::ifstream in(path, std::ios::binary);
+  std::stringstream bytes;
+  bytes << in.rdbuf();
+  return bytes.str();
+}
+
+// SECTION: SNAPSHOTS AND DELTAS
+
+TEST_CASE("a session resumes from a snapshot at every step") {
+  for (bool lazy : {false, true}) {
+    CAPTURE(lazy);
+    each_path(lazy, [&](auto &module, auto &choices) {
+      Engine engine = engine_for(module, lazy);
+      auto steps = play(engine, engine.start(), choices);
+
+      Engine saved = engine_for(module, lazy);
+      saved.start();
+      for (size_t i = 0; i < steps.size(); i++) {
+        // Restored on an engine that has yet to load the module
+        Engine resumed = engine_for("", lazy);
+        REQUIRE(!resumed.restore(saved.snapshot()));
+        auto rest = play(resumed, steps[i].response,
+                         choices_from(steps, choices, i));
+        CHECK(transcript(rest) == transcript(steps, i));
+        if (i + 1 < steps.size()) {
+          advance(saved, steps[i].response, steps[i].choice);
+        }
+      }
+    });
+  }
+}
+
+TEST_CASE("a session resumes from a checkpoint and its deltas") {
+  for (bool lazy : {false, true}) {
+    CAPTURE(lazy);
+    each_path(lazy, [&](auto &module, auto &choices) {
+      Engine engine = engine_for(module, lazy);
+      auto steps = play(engine, engine.start(), choices);
+
+      Engine saved = engine_for(module, lazy);
+      saved.start();
+      auto base = saved.checkpoint();
+      std::vector<std::vector<uint8_t>> deltas;
+      for (size_t i = 0; i + 1 < steps.size(); i++) {
+        advance(saved, steps[i].response, steps[i].choice);
+        auto delta = saved.delta();
+        REQUIRE(delta);
+        deltas.push_back(std::move(*delta));
+      }
+
+      // Step i is the base plus the first i deltas
+      for (size_t i = 0; i < steps.size(); i++) {
+        Engine resumed = engine_for("", lazy);
+        REQUIRE(!resumed.restore(base));
+        for (size_t j = 0; j < i; j++) {
+          REQUIRE(!resumed.apply_delta(deltas[j]));
+        }
+        auto rest = play(resumed, steps[i].response,
+                         choices_from(steps, choices, i));
+        CHECK(transcript(rest) == transcript(steps, i));
+      }
+
+      if (deltas.size() >= 2) {
+        Engine skipped = engine_for("", lazy);
+        REQUIRE(!skipped.restore(base));
+        CHECK(skipped.apply_delta(deltas[1]));
+      }
+    });
+  }
+}
+
+// SECTION: REWIND
+
+TEST_CASE("rewinding goes back through every step") {
+  for (bool lazy : {false, true}) {
+    CAPTURE(lazy);
+    each_path(lazy, [&](auto &module, auto &choices) {
+      Engine engine = engine_for(module, lazy);
+      engine.set_rewind_limit(64 << 20);
+      auto steps = play(engine, engine.start(), choices);
+
+      // Back as far as the module the path ended up in was started
+      size_t first = 0;
+      for (size_t i = 1; i < steps.size(); i++) {
+        if (std::holds_alternative<GoModule>(steps[i - 1].response))
+          first = i;
+      }
+      for (size_t i = steps.size() - 1; i > first; i--) {
+        CHECK(describe(engine.rewind()) == describe(steps[i - 1].response));
+      }
+      auto rest = play(engine, steps[first].response,
+                       choices_from(steps, choices, first));
+      CHECK(transcript(rest) == transcript(steps, first));
+    });
+  }
+}
+
+// SECTION: PACKS AND COMPILED MODULES
+
+TEST_CASE("a pack plays like the files it was made from") {
+  auto codex = load_codex(test_path("test.codex"));
+  REQUIRE(codex.value);
+  std::vector<std::pair<std::string, std::string>> source{
+      {"test.codex", read_file(test_path("test.codex"))}};
+  std::vector<std::pair<std::string, std::string>> compiled{
+      {"test.codex", save_compiled(*codex.value)}};
+  for (auto &module : test_modules()) {
+    auto loaded = load_module(module, codex.value);
+    REQUIRE(loaded.value);
+    source.emplace_back(module, read_file(test_path(module)));
+    compiled.emplace_back(module, save_compiled(*loaded.value));
+  }
+
+  for (auto *files : {&source, &compiled}) {
+    bool is_compiled = files == &compiled;
+    CAPTURE(is_compiled);
+    auto pack_path = std::filesystem::temp_directory_path() /
+                     (is_compiled ? "skald_test_compiled.skpak"
+                                  : "skald_test_source.skpak");
+    std::ofstream(pack_path, std::ios::binary) << save_pack(*files);
+    std::string why;
+    auto reader = pack_source_reader(pack_path.string(), &why);
+    REQUIRE_MESSAGE(reader, why);
+    auto packed_codex = load_codex("test.codex", *reader);
+    REQUIRE(packed_codex.value);
+
+    each_path(false, [&](auto &module, auto &choices) {
+      Engine engine = engine_for(module);
+      auto steps = play(engine, engine.start(), choices);
+
+      Engine packed;
+      packed.set_module_cache(nullptr);
+      packed.setup(packed_codex.value);
+      packed.set_source_reader(*reader);
+      REQUIRE(packed.load(module).ok);
+      CHECK(transcript(play(packed, packed.start(), choices)) ==
+            transcript(steps));
+    });
+  }
+}
+
+TEST_CASE("a lazily loaded module compiles to one that plays like it") {
+  auto codex = load_codex(test_path("test.codex"));
+  REQUIRE(codex.value);
+  for (auto &module : test_modules()) {
+    auto lazy = load_module(module, codex.value, SourceReader{}, true);
+    REQUIRE(lazy.value);
+    std::string why;
+    auto bytes = save_compiled(*lazy.value, &why);
+    REQUIRE_MESSAGE(!bytes.empty(), why);
+
+    // Served compiled in place of its source; a GO still reads source
+    auto file_path = codex.value->resolve_path(module);
+    SourceReader reader =
+        [&](const std::string &path) -> std::optional<std::string> {
+      return path == file_path ? bytes : default_source_reader(path);
+    };
+    each_path(module, false, [&](auto &, auto &choices) {
+      Engine engine = engine_for(module);
+      auto steps = play(engine, engine.start(), choices);
+
+      Engine compiled;
+      compiled.set_module_cache(nullptr);
+      compiled.setup(codex.value);
+      compiled.set_source_reader(reader);
+      REQUIRE(compiled.load(module).ok);
+      CHECK(transcript(play(compiled, compiled.start(), choices)) ==
+            transcript(steps));
+    });
+  }
+}
@@ -0,0 +1,197 @@
+#include "skald_test.h"
+#include <algorithm>
+#include <doctest/doctest.h>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+namespace SkaldTest {
+
+std::string test_path(const std::string &name) {
+  return (fs::path(SKALD_TEST_DIR) / name).string();
+}
+
+std::vector<std::string> test_modules() {
+  std::vector<std::string> modules;
+  for (auto &entry : fs::directory_iterator(SKALD_TEST_DIR)) {
+    if (entry.path().extension() == ".ska") {
+      modules.push_back(entry.path().filename().string());
+    }
+  }
+  std::sort(modules.begin(), modules.end());
+  return modules;
+}
+
+Engine engine_for(const std::string &module, bool lazy) {
+  Engine engine;
+  engine.set_module_cache(nullptr);
+  engine.set_lazy_blocks(lazy);
+  REQUIRE(engine.setup(test_path("test.codex")).ok);
+  if (!module.empty()) {
+    REQUIRE(engine.load(module).ok);
+  }
+  return engine;
+}
+
+QueryAnswer answer_for(const MethodCall &call) {
+  if (call.method == "returns_something") {
+    return QueryAnswer{.val = 5};
+  }
+  if (call.method == "returns_w_args") {
+    return QueryAnswer{.val = std::string("answered")};
+  }
+  return QueryAnswer{};
+}
+
+static std::string stitch(const std::vector<Chunk> &chunks) {
+  std::string text;
+  for (auto &chunk : chunks) {
+    text += chunk.text;
+  }
+  return text;
+}
+
+std::string describe(const Response &response) {
+  return std::visit(
+      [](const auto &r) -> std::string {
+        using T = std::decay_t<decltype(r)>;
+        if constexpr (std::is_same_v<T, Content>) {
+          return "content " + r.attribution + "|" + stitch(r.text);
+        } else if constexpr (std::is_same_v<T, OptionGroup>) {
+          std::string ret = "options";
+          for (auto &opt : r.options) {
+            ret += " [" + stitch(opt.text) + (opt.is_available ? "]" : " x]");
+          }
+          return ret;
+        } else if constexpr (std::is_same_v<T, MethodCallGet>) {
+          return "get " + r.key.text;
+        } else if constexpr (std::is_same_v<T, MethodCallPost>) {
+          return "post " + r.call.dbg_desc();
+        } else if constexpr (std::is_same_v<T, Notification>) {
+          return "notify " + r.dbg_desc();
+        } else if constexpr (std::is_same_v<T, GoModule>) {
+          return "go " + r.dbg_desc();
+        } else if constexpr (std::is_same_v<T, Exit>) {
+          return "exit " + r.dbg_desc();
+        } else if constexpr (std::is_same_v<T, End>) {
+          return "end";
+        } else if constexpr (std::is_same_v<T, Error>) {
+          // Paths in messages differ between checkouts
+          std::string message = r.message;
+          std::string root = test_path("");
+          for (size_t at; (at = message.find(root)) != std::string::npos;) {
+            message.erase(at, root.size());
+          }
+          return "error " + std::to_string(r.code) + " " + message;
+        }
+      },
+      response);
+}
+
+bool is_final(const Response &response) {
+  return std::holds_alternative<Exit>(response) ||
+         std::holds_alternative<End>(response) ||
+         std::holds_alternative<Error>(response);
+}
+
+Response advance(Engine &engine, const Response &response, int choice) {
+  if (std::holds_alternative<OptionGroup>(response)) {
+    return engine.act(choice);
+  }
+  if (auto *get = std::get_if<MethodCallGet>(&response)) {
+    return engine.answer(answer_for(get->call));
+  }
+  if (auto *go = std::get_if<GoModule>(&response)) {
+    if (!engine.load(go->module_path).ok) {
+      return Error(ERROR_LOADING_MODULE, "Couldn't load " + go->module_path,
+                   go->line_number);
+    }
+    return go->start_in_tag.empty() ? engine.start()
+                                    : engine.start_at(go->start_in_tag);
+  }
+  return engine.act(0);
+}
+
+std::vector<Step> play(Engine &engine, Response first,
+                       const std::vector<int> &choices) {
+  std::vector<Step> steps{Step{.response = std::move(first)}};
+  size_t next_choice = 0;
+  while (!is_final(steps.back().response) && steps.size() < MAX_STEPS) {
+    auto &step = steps.back();
+    if (std::holds_alternative<OptionGroup>(step.response)) {
+      if (next_choice == choices.size()) {
+        break;
+      }
+      step.choice = choices[next_choice++];
+    }
+    auto next = advance(engine, step.response, step.choice);
+    steps.push_back(Step{.response = std::move(next)});
+  }
+  return steps;
+}
+
+std::string transcript(const std::vector<Step> &steps, size_t from) {
+  std::string text;
+  for (size_t i = from; i < steps.size(); i++) {
+    text += describe(steps[i].response);
+    if (std::holds_alternative<OptionGroup>(steps[i].response) &&
+        i + 1 < steps.size()) {
+      text += " -> " + std::to_string(steps[i].choice);
+    }
+    text += "\n";
+  }
+  return text;
+}
+
+size_t choices_before(const std::vector<Step> &steps, size_t index) {
+  return std::count_if(steps.begin(), steps.begin() + index, [](auto &step) {
+    return std::holds_alternative<OptionGroup>(step.response);
+  });
+}
+
+static void walk(Engine &engine, Response response, std::vector<int> &path,
+                 std::vector<std::vector<int>> &paths, std::string *tree) {
+  std::string indent(path.size() * 2, ' ');
+  for (size_t n = 0; n < MAX_STEPS; n++) {
+    if (tree)
+      *tree += indent + describe(response) + "\n";
+    auto *group = std::get_if<OptionGroup>(&response);
+    if (is_final(response) || (group && path.size() == MAX_CHOICES)) {
+      paths.push_back(path);
+      return;
+    }
+    if (!group) {
+      response = advance(engine, response, 0);
+      continue;
+    }
+    bool any = false;
+    for (size_t i = 0; i < group->options.size(); i++) {
+      if (!group->options[i].is_available)
+        continue;
+      any = true;
+      if (tree)
+        *tree += indent + "> " + std::to_string(i) + "\n";
+      Engine fork = engine.fork();
+      auto next = fork.act(i);
+      path.push_back(i);
+      walk(fork, std::move(next), path, paths, tree);
+      path.pop_back();
+    }
+    if (!any)
+      paths.push_back(path);
+    return;
+  }
+  if (tree)
+    *tree += indent + "(cut off)\n";
+  paths.push_back(path);
+}
+
+std::vector<std::vector<int>> choice_paths(Engine &engine, Response first,
+                                           std::string *tree) {
+  std::vector<std::vector<int>> paths;
+  std::vector<int> path;
+  walk(engine, std::move(first), path, paths, tree);
+  return paths;
+}
+
+} // namespace SkaldTest
@@ -0,0 +1,69 @@
+#pragma once
+#include "skald.h"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Shared by the engine tests: plays the modules under test/ the way a client
+// would, and describes what comes back as text to compare.
+
+namespace SkaldTest {
+
+using namespace Skald;
+
+/** Menus deeper than this end a path; the test modules loop back on
+ *  themselves, so not every path ends */
+static constexpr size_t MAX_CHOICES = 6;
+
+/** Responses past this on one path (without a menu) end it too */
+static constexpr size_t MAX_STEPS = 256;
+
+/** Absolute path of a file under test/ */
+std::string test_path(const std::string &name);
+
+/** The .ska files under test/, relative to the codex, sorted */
+std::vector<std::string> test_modules();
+
+/** An engine set up on test/test.codex with module loaded, unless it's
+ *  empty. It has no module cache, so every engine parses afresh. */
+Engine engine_for(const std::string &module, bool lazy = false);
+
+/** What a query is answered with: a fixed value per method, so transcripts
+ *  are the same every run */
+QueryAnswer answer_for(const MethodCall &call);
+
+/** One line of transcript for response */
+std::string describe(const Response &response);
+
+/** True for an EXIT, END or error, after which a path is done */
+bool is_final(const Response &response);
+
+/** Moves past response the way a player would: continues content, takes
+ *  choice at a menu, answers queries (see answer_for) and follows GOs. */
+Response advance(Engine &engine, const Response &response, int choice);
+
+/** A response and the choice taken at it (0 unless it's a menu) */
+struct Step {
+  Response response;
+  int choice = 0;
+};
+
+/** Plays engine on from first, taking choices at each menu in turn, until
+ *  the story stops, the choices run out or MAX_STEPS. The last step is where
+ *  it stopped, and wasn't advanced past. */
+std::vector<Step> play(Engine &engine, Response first,
+                       const std::vector<int> &choices);
+
+/** Lines of steps from step from on */
+std::string transcript(const std::vector<Step> &steps, size_t from = 0);
+
+/** The choices made before step index of steps */
+size_t choices_before(const std::vector<Step> &steps, size_t index);
+
+/** Every path through the menus from first, as the choices taken, walking
+ *  each available option on a fork of engine. If tree is given, the
+ *  responses along the way are written to it, indented by menu depth. */
+std::vector<std::vector<int>> choice_paths(Engine &engine, Response first,
+                                           std::string *tree = nullptr);
+
+} // namespace SkaldTest
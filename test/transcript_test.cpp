@@ -0,0 +1,57 @@
+#include "reference/tree_walker.h"
+#include "skald_test.h"
+#include <doctest/doctest.h>
+
+using namespace SkaldTest;
+
+// Every module under test/ is walked down every path through its menus, and
+// the compiled engine has to say what the tree walker it replaced (see
+// reference/) says along each one. Queries are left out of the comparison:
+// the compiled engine asks them lazily, drops duplicates and reuses cached
+// answers, so it asks fewer, but what comes of the answers has to match.
+
+/** The lines of steps SkaldReference::play_described would give */
+static std::string described(const std::vector<Step> &steps) {
+  std::string lines;
+  for (auto &step : steps) {
+    if (!std::holds_alternative<MethodCallGet>(step.response)) {
+      lines += describe(step.response) + "\n";
+    }
+  }
+  return lines;
+}
+
+TEST_CASE("every choice path plays like it did on the tree walker") {
+  for (auto &module : test_modules()) {
+    CAPTURE(module);
+    Engine walker = engine_for(module);
+    auto paths = choice_paths(walker, walker.start());
+    CHECK(!paths.empty());
+
+    for (auto &choices : paths) {
+      std::string path = module + ":";
+      for (int choice : choices) {
+        path += " " + std::to_string(choice);
+      }
+      CAPTURE(path);
+      Engine engine = engine_for(module);
+      auto steps = play(engine, engine.start(), choices);
+      CHECK(described(steps) ==
+            SkaldReference::play_described(test_path("test.codex"), module,
+                                           choices, MAX_STEPS,
+                                           test_path("")));
+    }
+  }
+}
+
+TEST_CASE("a lazily loaded module plays like an eager one") {
+  for (auto &module : test_modules()) {
+    CAPTURE(module);
+    Engine eager = engine_for(module);
+    Engine lazy = engine_for(module, true);
+    std::string eager_tree, lazy_tree;
+    choice_paths(eager, eager.start(), &eager_tree);
+    choice_paths(lazy, lazy.start(), &lazy_tree);
+    CHECK(lazy_tree == eager_tree);
+  }
+}